@@ -5,6 +5,8 @@
  * @brief
  */
 
+#include <Poco/RunnableAdapter.h>
+
 #include "Aggregator.h"
 #include "IOcontrol.h"
 #include "MosqClient.h"
@@ -19,6 +21,8 @@ using Poco::StringTokenizer;
 using Poco::Util::IniFileConfiguration;
 
 #define LIMIT_TIMESTAMP 1420070400
+#define AGG_IDLE_TIMEOUT 1000 // milliseconds
+#define AGG_EXPIRE_INTERVAL 60 // seconds
 
 void Aggregator::buttonCallback(int event_type) {
 	std::cout << "Callback::event_type: " << event_type << std::endl;
@@ -52,34 +56,78 @@ TimeWatchdog::TimeWatchdog(std::chrono::steady_clock::time_point _start) :
 }
 
 void TimeWatchdog::run() {
-	active = true;
 	while (!quit_global_flag) {
 		if (isTimeValid()) {
 			if (agg)
 				agg->validateAllMessages(time(NULL), getOffset());
 			break;
 		}
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		// Time is set by NTP, no need to poll it
+		clock.waitForChange();
 	}
 	active = false;
 }
 
 Aggregator::Aggregator(IOTMessage _msg, shared_ptr<MosqClient> _mq) :
 	log(Poco::Logger::get("Adaapp-AGG")),
-	cache_last_storing_time(time(NULL)),
+	permanent_cache_path("/tmp/permanent.cache"),
 	msg_default(_msg),
 	watchdog(std::chrono::steady_clock::now()),
-	mq(_mq)
+	mq(_mq),
+	link_healthy(true),
+	cache_reconnect_jitter(0),
+	cache_retry_interval(2),
+	cache_batch_size(1),
+	cache_batch_timeout(0),
+	send_queue_size(64),
+	send_threads(2),
+	cache_drain_window(1),
+	cache_preserialize(false),
+	cache_compress(false),
+	backpressure(BACKPRESSURE_NONE),
+	cache_level(BACKPRESSURE_NONE),
+	queue_level(BACKPRESSURE_NONE),
+	backpressure_depth(1000),
+	backpressure_soft_factor(2),
+	backpressure_hard_factor(4),
+	metrics_interval(0)
 {
 	cache_lock.reset(new FastMutex);
 	cache.clear();
+	cache.setBudget(0);
+
+	unsigned int journal_segment_size = 65536;
+	unsigned int journal_max_segments = 4;
+	unsigned int journal_flush_interval = 1000;
 
 	AutoPtr<IniFileConfiguration> cfg;
 	try {
 		cfg = new IniFileConfiguration(CONFIG_FILE);
-		cache_minimal_items = cfg->getInt("cache.minimal_items_cached", 10);
-		cache_minimal_time = cfg->getInt("cache.minimal_saving_time", 10);        // in minutes
+		journal_segment_size = std::max(cfg->getInt("cache.journal_segment_size", 65536), 0);   // in bytes
+		journal_max_segments = std::max(cfg->getInt("cache.journal_max_segments", 4), 0);
+		journal_flush_interval = std::max(cfg->getInt("cache.journal_flush_interval", 1000), 0);   // in milliseconds
 		permanent_cache_path = cfg->getString("cache.permanent_cache_path", "/tmp/permanent.cache");
+		drain_bucket.setRate(cfg->getInt("cache.max_drain_rate", 0),            // messages per second
+				cfg->getInt("cache.drain_burst", 1));
+		cache_reconnect_jitter = std::max(cfg->getInt("cache.reconnect_jitter", 0), 0);     // in seconds
+		cache_retry_interval = std::max(cfg->getInt("cache.retry_interval", 2), 0);          // in seconds
+		cache_batch_size = std::max(cfg->getInt("cache.batch_size", 1), 1);
+		cache_batch_timeout = std::max(cfg->getInt("cache.batch_timeout", 0), 0);           // in milliseconds
+		cache.setBudget(std::max(cfg->getInt("cache.memory_budget", 0), 0));  // in bytes
+		send_queue_size = std::max(cfg->getInt("cache.send_queue_size", 64), 0);
+		send_threads = std::max(cfg->getInt("cache.send_threads", 2), 1);
+		cache_drain_window = std::max(cfg->getInt("cache.drain_window", 1), 1);
+		cache_preserialize = cfg->getBool("cache.preserialize", false);
+		cache_compress = cfg->getBool("cache.compress", false);
+		cache.setCompression(cache_compress);
+		configureLanes(cfg);
+		configureTTL(cfg);
+		configureMetrics(cfg);
+		backpressure_depth = std::max(cfg->getInt("cache.backpressure_depth", 1000), 0);
+		backpressure_soft_factor = std::max(cfg->getInt("cache.backpressure_soft_factor", 2), 1);
+		backpressure_hard_factor = std::max(cfg->getInt("cache.backpressure_hard_factor", 4), 1);
+		cache.setCoalescing(std::max(cfg->getInt("cache.coalesce_window", 0), 0),           // in seconds
+				std::max(cfg->getInt("cache.coalesce_resolution", 0), 0));                  // in seconds
 
 		// Create distributor
 		if (cfg->getBool("distributor.enabled", false))
@@ -89,6 +137,8 @@ Aggregator::Aggregator(IOTMessage _msg, shared_ptr<MosqClient> _mq) :
 		log.error("Exception with config file reading:\n" + ex.displayText());
 	}
 
+	journal.reset(new CacheJournal(permanent_cache_path, journal_segment_size, journal_max_segments, journal_flush_interval));
+
 #ifdef LEDS_ENABLED
 	LEDControl::blinkLED(LED_PAN, 3);
 #endif
@@ -138,117 +188,298 @@ void Aggregator::run() {
 	if (dist)
 		distThread.start(*dist);
 
+	Poco::Thread journalThread("Journal thread");
+	journalThread.start(*journal);
+
+	// More senders, so one slow response of the server does not delay messages of other modules
+	Poco::RunnableAdapter<Aggregator> sender(*this, &Aggregator::runSender);
+	std::vector<std::unique_ptr<Poco::Thread>> senderThreads;
+	for (unsigned int i = 0; i < send_threads; i++) {
+		senderThreads.emplace_back(new Poco::Thread("Sender thread " + to_string(i)));
+		senderThreads.back()->start(sender);
+	}
+
 	// Button's handler thread
 	button_t = std::thread (buttonControl);
 
 	Poco::Thread watchdog_t;
+	bool watchdog_started = false;
 	watchdog.setAgg(this);
 
-	// Initialize timer at least as possible
-	cache_last_storing_time = time(NULL);
-
 	// try to load stored cache to SD card and add items (which may not has been sent to server) to cache and takes it like another IoT messages ready to send to server.
 	cache_lock->lock();
 	loadCache();
 
 	printCache(false);
+	updateCacheLevel();
 	cache_lock->unlock();
+	updateBackpressure();
+
+	// Cache is drained by more threads, so more messages can wait for the response of server
+	Poco::RunnableAdapter<Aggregator> drainer(*this, &Aggregator::runDrain);
+	std::vector<std::unique_ptr<Poco::Thread>> drainThreads;
+	for (unsigned int i = 0; i < cache_drain_window; i++) {
+		drainThreads.emplace_back(new Poco::Thread("Drain thread " + to_string(i)));
+		drainThreads.back()->start(drainer);
+	}
 
+	std::chrono::steady_clock::time_point next_expire = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point next_report = std::chrono::steady_clock::now() + std::chrono::seconds(metrics_interval);
 	while (!quit_global_flag) {
 		// If there is not valid time, blackout is signalled. Start process for measuring the blackou length to create new timestamps.
-		// Cache is flushed to not to lose current items (in case of application restart during solving of blackout)
 		if (!isTimeValid() && (!watchdog.isActive())){
 			log.warning("Blackout of time service!");
+
+			// Thread of the previous blackout has finished already
+			if (watchdog_started)
+				watchdog_t.join();
 			watchdog.setBlackouStartPoint(std::chrono::steady_clock::now());
 			watchdog_t.start(watchdog);
-			cache_lock->lock();
-			if (!cache.empty())
-				storeCache();
-			cache_lock->unlock();
+			watchdog_started = true;
+		}
+		if (std::chrono::steady_clock::now() >= next_expire) {
+			expireCache();
+			next_expire = std::chrono::steady_clock::now() + std::chrono::seconds(AGG_EXPIRE_INTERVAL);
 		}
+		if (metrics_interval > 0 && std::chrono::steady_clock::now() >= next_report) {
+			reportMetrics();
+			next_report = std::chrono::steady_clock::now() + std::chrono::seconds(metrics_interval);
+		}
+
+		// Backpressure is updated by changes of the cache, so the thread sleeps
+		// until the next periodic task, a change of system time or stop()
+		std::chrono::steady_clock::time_point wake_at = next_expire;
+		if (metrics_interval > 0)
+			wake_at = std::min(wake_at, next_report);
+		long int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(wake_at - std::chrono::steady_clock::now()).count();
+		if (remaining > 0)
+			clock.waitForChange(remaining);
+	}
+
+	if (watchdog_started)
+		watchdog_t.join();
+
+	// Sending threads still write records to the journal, so it is flushed after them
+	for (auto &thread : drainThreads)
+		thread->join();
+	for (auto &thread : senderThreads)
+		thread->join();
+	distThread.join();
+	journalThread.join();
+	journal->flush();
+}
+
+/**
+ * Interrupt waiting of the Aggregator thread and of the time watchdog, so they can exit.
+ */
+void Aggregator::stop() {
+	clock.wakeUp();
+	watchdog.stop();
+
+	// Every event wakes up one thread, it wakes up the next one before it exits
+	cache_event.set();
+	link_event.set();
+	send_event.set();
+}
+
+/**
+ * Thread function sending messages from the cache. Every drain thread sends
+ * one message (or batch) at a time, messages are taken in the order of their
+ * priority and failed messages are returned to the cache with their original key.
+ */
+void Aggregator::runDrain() {
+	while (!quit_global_flag) {
+		bool no_sendable_msg = true;
+		bool sent = false;
+
+		// Message waits for the drain rate in the cache, so it is still counted there
+		throttleDrain(1);
+
 		if (cache_lock->tryLock(1000)) {
 			if (!cache.empty()) {
-				log.information("Items in queue (" + toStringFromInt(cache.size()) + ")");
+				log.debug("Items in queue (" + toStringFromInt(cache.size()) + ")");
 
-				multimap<Cache_Key, IOTMessage>::iterator it = cache.begin();
-				// Search item with valid timestamp and highest priority. Validity is not part of the key because it is changed on
-				// several places in the code (changing would hurt performance)
-				while ((it != cache.end()) && !(it->second.valid)) {
-					++it;
-				}
-				// Check if there is any message which can be send.
-				bool no_sendable_msg = (it != cache.end()) ? false : true;
-
-				long long int now = std::time(NULL);
-				// Save to cache if this condition is satisfied.
-				if ((now - cache_last_storing_time > (cache_minimal_time*60)) && (cache.size() >= cache_minimal_items)) {
-					log.information("Items (" + std::to_string(cache.size()) + ") are accumulated in cache -> saved to file \"" + permanent_cache_path + "\".");
-					log.information("Last cache-storing time: \"" + toStringFromLongInt(cache_last_storing_time) + "\", new time (now): \"" + toStringFromLongInt(now) + "\"");
-					storeCache();
-				}
-
-				pair<Cache_Key, IOTMessage> item;
+				// Take item with valid timestamp and highest priority (if there is any)
+				Cache_Item item;
+				no_sendable_msg = !cache.pop(item);
 				if (!no_sendable_msg) {
-					item = (*it);
-					cache.erase(it);
+					metrics.dequeued();
+					log.debug("Removed from the Aggregator's cache queue, now contains " + toStringFromInt(cache.size()) + " items.");
 
-					log.information("Removed from the Aggregator's cache queue, now contains " + toStringFromInt(cache.size()) + " items.");
+					// Event wakes up only one drain thread, the next one takes the rest
+					if (cache_drain_window > 1 && cache.sendableCount() > 0)
+						cache_event.set();
 				}
+				bool changed = updateCacheLevel();
 				cache_lock->unlock();
+				if (changed)
+					updateBackpressure();
 
 				// Primary function to send data to server
-				if (!no_sendable_msg)
-					sendData(item.second);
+				if (!no_sendable_msg && cache_batch_size > 1) {
+					std::vector<Cache_Item> batch(1, item);
+					collectBatch(batch);
+					sent = sendBatch(batch);
+				}
+				else if (!no_sendable_msg) {
+					sent = sendCached(item);
+				}
 			}
 			else {    // Queue is empty
-				// Update time of last cache save. Otherwise it can be saved in wrong time.
-				cache_last_storing_time = time(NULL);
-
-				// remove file if the cache is empty = this means that all messages were successfully sent to server
-				File x(permanent_cache_path);
-				if (x.exists()) {
-					log.information("Cache is now empty, so file \"" + permanent_cache_path + "\" with backup of cache is no longer needed - removing it.");
-					try{
-						x.remove();
-					}
-					catch (Poco::Exception& ex){
-						log.error("Error in removing permanent cache file");
-					}
-				}
 				cache_lock->unlock();
 			}
 		}
 		else {
 			log.warning("Cannot lock Aggregator's cache!.");
 		}
-		sleep(2);
+		if (no_sendable_msg)
+			drain_bucket.release(1);
+
+		// Drain the cache back-to-back while the server accepts messages, otherwise
+		// sleep until something is cached or the server becomes reachable again.
+		if (sent)
+			continue;
+		else if (!no_sendable_msg)
+			waitForRetry();
+		else
+			cache_event.wait();
 	}
 
-	distThread.join();
+	cache_event.set();
+	link_event.set();
 }
 
 pair<bool, Command> Aggregator::sendData(IOTMessage _msg) {
-	IOTMessage msg(_msg);
+	return deliverData(_msg, true, std::chrono::steady_clock::now());
+}
+
+/**
+ * Queue message for sending to the server, the calling thread does not wait for
+ * the connection to the server. Data messages are cached when the queue is full.
+ * @return Future response of the server, only callers interested in it have to wait
+ */
+future<pair<bool, Command>> Aggregator::sendDataAsync(IOTMessage _msg) {
+	Send_Request request;
+	request.msg = _msg;
+	request.submitted = std::chrono::steady_clock::now();
+	future<pair<bool, Command>> response = request.response.get_future();
+	size_t queued = 0;
+	bool changed = false;
+
+	{
+		FastMutex::ScopedLock guard(send_lock);
+
+		if (!quit_global_flag && (send_queue.size() < send_queue_size || _msg.state != "data")) {
+			send_queue.push_back(std::move(request));
+			send_event.set();
+			queued = send_queue.size();
+			changed = updateQueueLevel();
+		}
+	}
+
+	if (changed)
+		updateBackpressure();
+	if (queued > 0)
+		return response;
+
+	if (!quit_global_flag)
+		log.warning("Queue of messages for server is full.");
+	request.response.set_value(deliverData(_msg, false, request.submitted));
+	return response;
+}
+
+/**
+ * Thread function sending messages queued by sendDataAsync(), more threads share the queue.
+ */
+void Aggregator::runSender() {
+	while (!quit_global_flag) {
+		Send_Request request;
+		bool queued = false;
+		bool changed = false;
+
+		{
+			FastMutex::ScopedLock guard(send_lock);
+
+			if (!send_queue.empty()) {
+				request = std::move(send_queue.front());
+				send_queue.pop_front();
+				queued = true;
+				changed = updateQueueLevel();
+
+				// Event wakes up only one sender, the next one takes the rest
+				if (!send_queue.empty())
+					send_event.set();
+			}
+		}
+		if (changed)
+			updateBackpressure();
+
+		if (queued)
+			request.response.set_value(deliverData(request.msg, true, request.submitted));
+		else
+			send_event.wait();
+	}
+	send_event.set();
+
+	// Messages which were not sent before exit are cached
+	std::deque<Send_Request> unsent;
+	{
+		FastMutex::ScopedLock guard(send_lock);
+		unsent.swap(send_queue);
+	}
+	for (Send_Request &request : unsent)
+		request.response.set_value(deliverData(request.msg, false, request.submitted));
+}
+
+/**
+ * Send message to the server or store it to the cache.
+ * @param msg Message to send
+ * @param try_send Data messages are cached without an attempt to send them when false
+ * @param submitted Monotonic time when the message was given to the Aggregator
+ * @return Pair of success flag and command from the response, data message deferred
+ * to the cache is successful with command of empty state
+ */
+pair<bool, Command> Aggregator::deliverData(IOTMessage msg, bool try_send, std::chrono::steady_clock::time_point submitted) {
 	Command c;
 	pair<bool, Command> retval = std::pair<bool, Command>(false, c);
 
+	// Data are sent from the cache (in batches when batching is enabled). Every deferred
+	// message is journaled, so batching costs add and del records of every reading
+	// on the SD card, which messages sent at once avoid unless their send fails.
+	bool deferred = (msg.state == "data" && (cache_batch_size > 1 || !try_send));
+
+	// Sequence number is assigned before the first attempt, so the server can
+	// recognize a retry of message whose acknowledgement was lost
+	if (msg.state == "data" && msg.seq == 0)
+		msg.seq = journal->allocateId();
+
 	// Send valid message
+	bool acked = false;
 	if (isTimeValid(msg.time)){
-		retval = tcp->sendToServer(msg);
+		if (!deferred) {
+			retval = sendToServer(msg);
+			acked = isAcked(retval, msg.seq);
+		}
 	} else {
 		// Message with invalid timestamp came in valid time
 		msg.valid = false;
-		msg.offset = watchdog.getOffset();
+		msg.offset = watchdog.getOffset(submitted);
 	}
 
-	if (!retval.first && msg.state == "data") {
-		if (isTimeValid(msg.time))
-			log.warning("Failed to send message (ts=" + to_string(msg.time) + ") to server - save to cache!");
-		else
+	if (!acked && msg.state == "data") {
+		if (!isTimeValid(msg.time))
 			log.warning("Can't send message (ts=" + to_string(msg.time) + ") to server - its time is not valid - save to cache!");
-		cache_lock->lock();
-		cache.insert(make_pair(Cache_Key(msg.priority, msg.time), msg));
-		cache_lock->unlock();
+		else if (deferred) {
+			// Message will be sent from the cache, queueing it is the success of caller
+			log.debug("Message (ts=" + to_string(msg.time) + ") queued in the cache.");
+			retval.first = true;
+			retval.second.state = "";
+		}
+		else if (retval.first)
+			log.warning("Server did not acknowledge message (seq=" + to_string(msg.seq) + ") - save to cache!");
+		else
+			log.warning("Failed to send message (ts=" + to_string(msg.time) + ") to server - save to cache!");
+		cacheMessage(msg);
 	}
 	// Distribute to other listeners
 	// TODO - Send even if it is not valid?
@@ -258,6 +489,473 @@ pair<bool, Command> Aggregator::sendData(IOTMessage _msg) {
 	return retval;
 }
 
+/**
+ * Check whether the server acknowledged the message. Response without any acks
+ * acknowledges all messages of the request.
+ * @param seq Sequence number of the message
+ * @param index Index of the message in a batch (-1 if it was sent alone)
+ */
+bool Aggregator::isAcked(const pair<bool, Command> &response, uint64_t seq, int index) {
+	const Command &cmd = response.second;
+
+	if (!response.first)
+		return false;
+	if (cmd.acks.empty() && cmd.acked_seqs.empty())
+		return true;
+
+	return (index >= 0 && std::find(cmd.acks.begin(), cmd.acks.end(), index) != cmd.acks.end())
+		|| (seq != 0 && std::find(cmd.acked_seqs.begin(), cmd.acked_seqs.end(), seq) != cmd.acked_seqs.end());
+}
+
+pair<bool, Command> Aggregator::sendToServer(const IOTMessage &msg) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pair<bool, Command> retval = tcp->sendToServer(msg);
+	metrics.latency(std::chrono::steady_clock::now() - start);
+	if (msg.state == "data") {
+		bool acked = isAcked(retval, msg.seq);
+		metrics.sent(acked ? 1 : 0, acked ? 0 : 1);
+	}
+	updateLinkState(retval.first);
+	if (retval.first)
+		updatePacing(retval.second);
+	return retval;
+}
+
+/**
+ * Remember the result of the last send.
+ */
+void Aggregator::updateLinkState(bool healthy) {
+	// Wake up the cache drain when the server becomes reachable again. The drain
+	// starts after a random delay, so the gateways do not flood the server at once.
+	if (healthy && !link_healthy.exchange(true)) {
+		if (cache_reconnect_jitter > 0) {
+			std::random_device random;
+			std::uniform_int_distribution<long int> jitter(0, cache_reconnect_jitter * 1000L);
+			long int delay = jitter(random);
+
+			drain_bucket.pause(std::chrono::milliseconds(delay));
+			log.information("Server is reachable again, cache drain starts in " + to_string(delay) + " ms.");
+		}
+		link_event.set();
+		updateBackpressure();
+	}
+	else if (!healthy && link_healthy.exchange(false)) {
+		updateBackpressure();
+	}
+}
+
+/**
+ * Apply the drain rate requested by the server in its response.
+ */
+void Aggregator::updatePacing(const Command &cmd) {
+	if (cmd.drain_rate < 0)
+		return;
+
+	double burst = (cmd.drain_burst > 0) ? cmd.drain_burst : drain_bucket.getBurst();
+	if (cmd.drain_rate == drain_bucket.getRate() && burst == drain_bucket.getBurst())
+		return;
+
+	drain_bucket.setRate(cmd.drain_rate, burst);
+	log.information("Server set the drain rate to " + to_string(cmd.drain_rate) + " messages per second.");
+}
+
+/**
+ * Send message from the cache. The message is removed from the journal
+ * after successful send, otherwise it is returned back to the cache.
+ * @return true if the message was sent
+ */
+bool Aggregator::sendCached(Cache_Item &item) {
+	prepareWire(item.msg);
+	if (isAcked(sendToServer(item.msg), item.msg.seq)) {
+		journal->remove(item.id);
+		return true;
+	}
+
+	cache_lock->lock();
+	cache.insert(item);
+	bool changed = updateCacheLevel();
+	cache_lock->unlock();
+	if (changed)
+		updateBackpressure();
+	return false;
+}
+
+/**
+ * Send messages from the cache in one envelope. Messages acknowledged by the server
+ * are removed from the journal, the others are returned back to the cache.
+ * @return true if at least one message was acknowledged
+ */
+bool Aggregator::sendBatch(std::vector<Cache_Item> &batch) {
+	std::vector<IOTMessage> msgs;
+	for (Cache_Item &item : batch) {
+		prepareWire(item.msg);
+		msgs.push_back(item.msg);
+	}
+
+	log.information("Sending batch of " + to_string(batch.size()) + " cached messages.");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pair<bool, Command> retval = tcp->sendBatchToServer(msgs);
+	metrics.latency(std::chrono::steady_clock::now() - start);
+	updateLinkState(retval.first);
+	if (retval.first)
+		updatePacing(retval.second);
+
+	std::vector<bool> acked(batch.size());
+	for (unsigned int i = 0; i < batch.size(); i++)
+		acked[i] = isAcked(retval, batch[i].msg.seq, i);
+
+	unsigned int acked_count = 0;
+	cache_lock->lock();
+	for (unsigned int i = 0; i < batch.size(); i++) {
+		if (acked[i]) {
+			acked_count++;
+			continue;
+		}
+		cache.insert(batch[i]);
+	}
+	bool changed = updateCacheLevel();
+	cache_lock->unlock();
+	if (changed)
+		updateBackpressure();
+	metrics.sent(acked_count, batch.size() - acked_count);
+
+	for (unsigned int i = 0; i < batch.size(); i++) {
+		if (acked[i])
+			journal->remove(batch[i].id);
+	}
+
+	if (retval.first && acked_count < batch.size())
+		log.warning("Server acknowledged " + to_string(acked_count) + " of " + to_string(batch.size()) + " messages.");
+
+	return acked_count > 0;
+}
+
+/**
+ * Take sendable messages from the cache until the batch contains cache.batch_size
+ * messages or cache.batch_timeout expires. Every message is taken after it is
+ * allowed by the drain rate.
+ */
+void Aggregator::collectBatch(std::vector<Cache_Item> &batch) {
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(cache_batch_timeout);
+
+	while (!quit_global_flag && batch.size() < cache_batch_size) {
+		Cache_Item item;
+
+		throttleDrain(1);
+		cache_lock->lock();
+		bool popped = cache.pop(item);
+		bool changed = updateCacheLevel();
+		cache_lock->unlock();
+		if (changed)
+			updateBackpressure();
+
+		if (popped) {
+			metrics.dequeued();
+			batch.push_back(item);
+			continue;
+		}
+		drain_bucket.release(1);
+
+		long int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0)
+			break;
+		cache_event.tryWait(remaining);
+	}
+}
+
+/**
+ * Store message to the cache and its journal.
+ */
+void Aggregator::cacheMessage(const IOTMessage &msg) {
+	Cache_Item item(msg.seq != 0 ? msg.seq : journal->allocateId(), msg);
+	item.msg.seq = item.id;
+	std::vector<Cache_Item> updated;
+	std::vector<Cache_Item> removed;
+
+	// Compressed readings keep no serialized form, they are serialized when sent
+	if (!cache_compress)
+		prepareWire(item.msg);
+
+	// Journal is updated under the cache lock, so the messages cannot be sent
+	// (and removed from the journal) before they are stored
+	cache_lock->lock();
+	bool cached = cache.coalesce(item, updated, removed);
+	for (const Cache_Item &old_item : updated)
+		journal->update(old_item);
+	for (const Cache_Item &old_item : removed)
+		journal->remove(old_item.id);
+	if (cached) {
+		journal->update(item);
+		cache.insert(item);
+		metrics.enqueued();
+	}
+	std::vector<Cache_Item> evicted = cache.evict();
+	bool changed = updateCacheLevel();
+	cache_lock->unlock();
+
+	dropEvicted(evicted);
+	cache_event.set();
+	if (changed)
+		updateBackpressure();
+}
+
+/**
+ * Read send lanes of the cache. Priority with zero weight has no lane,
+ * its messages are sent before messages of all lanes.
+ */
+void Aggregator::configureLanes(AutoPtr<IniFileConfiguration> cfg) {
+	const std::vector<std::pair<std::string, MSG_PRIO>> names = {
+		{"registration", MSG_PRIO_REG},
+		{"actuator", MSG_PRIO_ACTUATOR},
+		{"param", MSG_PRIO_PARAM},
+		{"sensor", MSG_PRIO_SENSOR},
+		{"history", MSG_PRIO_HISTORY},
+	};
+
+	for (auto &name : names) {
+		unsigned int weight = std::max(cfg->getInt("cache.lane_" + name.first + "_weight", 0), 0);
+		std::string policy = cfg->getString("cache.lane_" + name.first + "_policy", "oldest");
+
+		if (weight == 0)
+			continue;
+		if (policy != "oldest" && policy != "newest")
+			log.warning("Unknown policy \"" + policy + "\" of " + name.first + " lane, using oldest");
+
+		cache.setLane(name.second, weight, policy == "newest" ? LANE_NEWEST_FIRST : LANE_OLDEST_FIRST);
+		log.information("Lane " + name.first + ": weight " + to_string(weight) + ", " + (policy == "newest" ? "newest" : "oldest") + " first");
+	}
+	cache.setLaneAging(std::max(cfg->getInt("cache.lane_aging", 0), 0));
+}
+
+/**
+ * Read TTLs of cached values from the [CacheTTL] section. Keys device_<device_id>
+ * set TTL of device type, keys module_<device_id>_<module_id> set TTL of its module.
+ */
+void Aggregator::configureTTL(AutoPtr<IniFileConfiguration> cfg) {
+	std::vector<std::string> keys;
+	cfg->keys("CacheTTL", keys);
+
+	for (const std::string &key : keys) {
+		StringTokenizer name(key, "_", StringTokenizer::TOK_TRIM);
+		int seconds = std::max(cfg->getInt("CacheTTL." + key, 0), 0);
+
+		if (name.count() == 2 && name[0] == "device" && toIntFromString(name[1]) >= 0) {
+			cache.setTTL(toIntFromString(name[1]), seconds);
+		}
+		else if (name.count() == 3 && name[0] == "module" && toIntFromString(name[1]) >= 0 && toIntFromString(name[2]) >= 0) {
+			cache.setTTL(toIntFromString(name[1]), toIntFromString(name[2]), seconds);
+		}
+		else {
+			log.warning("Unknown key \"" + key + "\" in [CacheTTL], ignoring it");
+			continue;
+		}
+		log.information("Cached values of " + key + " expire after " + to_string(seconds) + " seconds");
+	}
+}
+
+/**
+ * Create reporters of queue metrics from the [Metrics] section. Metrics are published
+ * to the MQTT topic BeeeOn/service and/or written to a local file.
+ */
+void Aggregator::configureMetrics(AutoPtr<IniFileConfiguration> cfg) {
+	metrics_interval = std::max(cfg->getInt("metrics.interval", 0), 0);   // in seconds
+	if (metrics_interval == 0)
+		return;
+
+	if (cfg->getBool("metrics.mqtt", false)) {
+		if (mq)
+			metrics_reporters.emplace_back(new MQTTMetricsReporter(mq, cfg->getString("metrics.mqtt_topic", "BeeeOn/service")));
+		else
+			log.warning("MQTT is disabled, queue metrics are not published to MQTT");
+	}
+
+	std::string path = cfg->getString("metrics.file", "");
+	if (!path.empty())
+		metrics_reporters.emplace_back(new FileMetricsReporter(path));
+
+	if (metrics_reporters.empty())
+		metrics_interval = 0;
+	else
+		log.information("Queue metrics are reported every " + to_string(metrics_interval) + " seconds");
+}
+
+/**
+ * Sample gauges of the cache, take counters and pass them to all reporters.
+ */
+void Aggregator::reportMetrics() {
+	Metrics_Snapshot snapshot;
+	long long int oldest;
+
+	cache_lock->lock();
+	snapshot.depth = cache.countByPriority();
+	snapshot.memory = cache.memoryUsage();
+	oldest = cache.oldestTime();
+	cache_lock->unlock();
+
+	snapshot.time = time(NULL);
+	if (oldest != 0 && isTimeValid())
+		snapshot.oldest_age = std::max(snapshot.time - oldest, 0LL);
+	snapshot.journal_bytes = journal->writtenBytes();
+	metrics.snapshot(snapshot);
+
+	for (auto &reporter : metrics_reporters)
+		reporter->report(snapshot);
+}
+
+/**
+ * Polling interval of a module prolonged according to the current backpressure.
+ * @param interval Polling interval without backpressure
+ */
+unsigned int Aggregator::scaleInterval(unsigned int interval) const {
+	switch (backpressure) {
+	case BACKPRESSURE_SOFT:
+		return interval * backpressure_soft_factor;
+	case BACKPRESSURE_HARD:
+		return interval * backpressure_hard_factor;
+	default:
+		return interval;
+	}
+}
+
+/**
+ * Compute backpressure of the cache from its backlog and memory budget. It is called
+ * after every change of the cache, lock of the cache must be held by the caller.
+ * @return true if a threshold was crossed and updateBackpressure() has to be called
+ */
+bool Aggregator::updateCacheLevel() {
+	size_t memory = cache.memoryUsage();
+	size_t budget = cache.getBudget();
+	Backpressure level = BACKPRESSURE_NONE;
+
+	if (budget > 0 && memory >= budget / 10 * 9)
+		level = BACKPRESSURE_HARD;
+	else if ((budget > 0 && memory >= budget / 2) || (backpressure_depth > 0 && cache.sendableCount() >= backpressure_depth))
+		level = BACKPRESSURE_SOFT;
+
+	return cache_level.exchange(level) != level;
+}
+
+/**
+ * Compute backpressure of the queue of sendDataAsync(). It is called after every change
+ * of the queue, send_lock must be held by the caller.
+ * @return true if a threshold was crossed and updateBackpressure() has to be called
+ */
+bool Aggregator::updateQueueLevel() {
+	Backpressure level = BACKPRESSURE_NONE;
+
+	if (send_queue.size() >= send_queue_size)
+		level = BACKPRESSURE_HARD;
+	else if (send_queue.size() >= send_queue_size / 2)
+		level = BACKPRESSURE_SOFT;
+
+	return queue_level.exchange(level) != level;
+}
+
+/**
+ * Combine backpressure of the cache, of the queue and of the link to the server.
+ * It is called only when one of them changes.
+ */
+void Aggregator::updateBackpressure() {
+	FastMutex::ScopedLock guard(backpressure_lock);
+
+	Backpressure state = std::max(cache_level.load(), queue_level.load());
+	if (!link_healthy)
+		state = std::max(state, BACKPRESSURE_SOFT);
+
+	if (backpressure.exchange(state) == state)
+		return;
+
+	static const char *names[] = {"none", "soft", "hard"};
+	log.information(std::string("Backpressure changed to ") + names[state] + ".");
+}
+
+/**
+ * Drop cached values older than their TTL instead of uploading them.
+ */
+void Aggregator::expireCache() {
+	if (!isTimeValid())
+		return;
+
+	std::vector<Cache_Item> updated;
+	std::vector<Cache_Item> removed;
+
+	cache_lock->lock();
+	cache.expire(time(NULL), updated, removed);
+	for (const Cache_Item &item : updated)
+		journal->update(item);
+	for (const Cache_Item &item : removed)
+		journal->remove(item.id);
+	bool changed = updateCacheLevel();
+	cache_lock->unlock();
+
+	if (changed)
+		updateBackpressure();
+
+	if (!updated.empty() || !removed.empty())
+		log.information("Dropped expired values of " + to_string(updated.size() + removed.size()) + " cached messages, "
+				+ to_string(removed.size()) + " of them were removed.");
+}
+
+/**
+ * Serialize the device of the message when cache.preserialize is enabled, so retries
+ * of the message only copy the serialized element. Messages restored from the journal,
+ * changed by coalescing or compressed in the cache are serialized before their first
+ * send from the cache.
+ */
+void Aggregator::prepareWire(IOTMessage &msg) {
+	if (!cache_preserialize || !msg.wire.empty() || msg.device.values.empty())
+		return;
+
+	XMLTool xml;
+	msg.wire = xml.createDeviceWire(msg.device);
+}
+
+/**
+ * Remove messages evicted from the cache (because of its memory budget) from the journal.
+ */
+void Aggregator::dropEvicted(const std::vector<Cache_Item> &evicted) {
+	if (evicted.empty())
+		return;
+
+	for (const Cache_Item &item : evicted)
+		journal->remove(item.id);
+
+	log.warning("Cache exceeded its memory budget, dropped " + to_string(evicted.size()) + " messages.");
+}
+
+/**
+ * Keep the drain rate of cached messages (of all drain threads) under the rate
+ * of drain_bucket. Waiting is interrupted by the exit of application.
+ * @param count Number of messages sent now
+ */
+void Aggregator::throttleDrain(unsigned int count) {
+	std::chrono::steady_clock::time_point send_at = std::chrono::steady_clock::now() + drain_bucket.reserve(count);
+
+	while (!quit_global_flag) {
+		long int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(send_at - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(std::min<long int>(remaining, AGG_IDLE_TIMEOUT)));
+	}
+}
+
+/**
+ * Wait after a failed send of cached message. Messages cached in the meantime
+ * do not interrupt the wait, only a successful send of another message does.
+ */
+void Aggregator::waitForRetry() {
+	std::chrono::steady_clock::time_point retry_at = std::chrono::steady_clock::now() + std::chrono::seconds(cache_retry_interval);
+
+	while (!quit_global_flag && !link_healthy) {
+		long int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(retry_at - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0)
+			break;
+		// Event wakes up only one drain thread, the next one is woken up by it
+		if (link_event.tryWait(remaining) && link_healthy)
+			link_event.set();
+	}
+}
+
 void Aggregator::setLedModule(shared_ptr<LedModule> lm) {
 	ledModule = lm;
 }
@@ -374,144 +1072,93 @@ void Aggregator::parseCmd(Command cmd) {
 }
 
 /*
- * Flush whole cache to a memory
+ * Load messages from the cache journal. Persistent cache in CSV format (from older versions)
+ * is converted to the journal and removed.
  * Important: It is crucial call cache_lock before and after the function call
  */
-void Aggregator::storeCache() {
-
-	// TODO Maybe better to do it even without distributor?
-	if (!dist) {
-		log.warning("Distributor does not exist - skipping storing to cache!");
-		return;
-	}
-
-	log.information("Storing cached items to file \"" + permanent_cache_path + "\"");
-
-	ofstream permanent_cache;
-	permanent_cache.open(permanent_cache_path.c_str());
-	for (auto item : cache) {
-		permanent_cache << dist->convertToCSV(item.second, true);
-	}
-	permanent_cache.close();
-
-	cache_last_storing_time = time(NULL);
-}
-
 void Aggregator::loadCache() {
-	File x(permanent_cache_path);
-	if (!x.exists()) {
-		log.information("There is no such file \"" + permanent_cache_path + "\" for restoring cache - nothing to do!");
-		return;
+	for (Cache_Item &item : journal->recovered()) {
+		restoreTimestamp(item.msg);
+		cache.insert(item);
 	}
+	dropEvicted(cache.evict());
 
-	ifstream permanent_cache;
-	permanent_cache.open(permanent_cache_path.c_str());
-
-	while (permanent_cache.good()) {
-		IOTMessage msg;
-
-		std::string line;
-		std::getline(permanent_cache, line);
-		if (((line == "") && !permanent_cache.good())) {
-			break;
-		}
-		else if (line == "\n")
-			continue;
-
-		StringTokenizer token(line, (std::string)";", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
-		for (unsigned int i = 0; i < (unsigned int)token.count();) {
-			if (token[i].compare("time") == 0)
-				msg.time = toIntFromString(token[i+1]);
-
-			else if (token[i].compare("euid") == 0)
-				msg.device.euid = stoull(token[i+1], nullptr, 0);
-
-			else if (token[i].compare("device_id") == 0)
-				msg.device.device_id = toIntFromString(token[i+1]);
-
-			else if (token[i].compare("dev_version") == 0)
-				msg.device.version = toIntFromString(token[i+1]);
-
-			else if (token[i].compare("valid") == 0)
-				msg.valid = (token[i+1].compare("yes") == 0) ? true : false;
-
-			else if (token[i].compare("state") == 0)
-				msg.state = token[i+1];
-
-			else if (token[i].compare("fw_version") == 0)
-				msg.fw_version = token[i+1];
-
-			else if (token[i].compare("protocol_version") == 0)
-				msg.protocol_version = token[i+1];
-
-			else if (token[i].compare("pairs") == 0)
-				msg.device.pairs = atoi(token[i+1].c_str());
+	File x(permanent_cache_path);
+	if (x.exists()) {
+		log.information("Converting persistent cache \"" + permanent_cache_path + "\" to the cache journal.");
 
-			else if (token[i].compare("tt_version") == 0)
-				msg.tt_version = toIntFromString(token[i+1]);
+		ifstream permanent_cache;
+		permanent_cache.open(permanent_cache_path.c_str());
 
-			else {
-				log.information("Unknown type of token name: " + token[i]);
-			}
-			i+=2;
-		}
-		for (int i = 0; i < msg.device.pairs; i++) {
+		while (permanent_cache.good()) {
+			std::string line;
 			std::getline(permanent_cache, line);
-			StringTokenizer token2(line, (std::string)";", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
-			int module_id = 0;
-			float value = 0;
-
-			for (unsigned int i = 0; i < (unsigned int)token2.count(); ) {
-				if (token2[i].compare("module_id") == 0)
-					module_id = toNumFromString(token2[i+1]);
-				else if (token2[i].compare("value") == 0)
-					value = toFloatFromString(token2[i+1]);
-				else {
-					log.information("Unknown type of token name: " + token2[i]);
-				}
-				i = i+2;
+			if (((line == "") && !permanent_cache.good())) {
+				break;
 			}
-			msg.device.values.push_back({module_id, value});
+			else if (line == "")
+				continue;
+
+			IOTMessage msg = Distributor::convertFromCSV(line, permanent_cache);
+			restoreTimestamp(msg);
+			msg.seq = journal->append(msg);
+			cache.insert(Cache_Item(msg.seq, msg));
+			dropEvicted(cache.evict());
 		}
-		// Four options
-		// 1) Valid msg timestamp   + valid system time     - everything is ok
-		// 2) Valid msg timestamp   + invalid system time   - ok, similar to above
-		// 3) Invalid msg timestamp + valid system time     - offset cannot be computed, message will be most probably dropped
-		// 4) Invalid msg timestamp + invalid system time   - offset can be computed (offset is difference between msg timestamp and current timestamp
-		if (isTimeValid(msg.time)) {     // Option 1 + 2
-			msg.offset = 0;
-			msg.valid = true;
-		}
-		else if (isTimeValid()) {                         // Option 3
-			// TODO Most probably nothing to do
-			log.information("This message has been stored with invalid TS, but now is time valid and I cannot find out origin TS.");
+		permanent_cache.close();
+
+		try {
+			x.remove();
 		}
-		else {                                            // Option 4
-			msg.offset = msg.time - time(NULL);       // Offset won't be negative (it is past, i.e. when that message came)
-			msg.valid = false;
-			log.information("This message has been stored with invalid TS, but now the time is not valid neither - so i can count offset from msg TS and actual TS.");
+		catch (Poco::Exception& ex) {
+			log.error("Error in removing permanent cache file");
 		}
-		msg.adapter_id = msg_default.adapter_id;
-		cache.insert(std::pair<Cache_Key, IOTMessage>(Cache_Key(msg.priority, msg.time), msg));
 	}
 	log.information("Loading of persistent cache is complete. Cache contains " + std::to_string(cache.size()) + " items.");
-	permanent_cache.close();
-	return;
+}
+
+/**
+ * Set validity of the message restored from the persistent cache.
+ */
+void Aggregator::restoreTimestamp(IOTMessage &msg) {
+	// Four options
+	// 1) Valid msg timestamp   + valid system time     - everything is ok
+	// 2) Valid msg timestamp   + invalid system time   - ok, similar to above
+	// 3) Invalid msg timestamp + valid system time     - offset cannot be computed, message will be most probably dropped
+	// 4) Invalid msg timestamp + invalid system time   - offset can be computed (offset is difference between msg timestamp and current timestamp
+	if (isTimeValid(msg.time)) {     // Option 1 + 2
+		msg.offset = 0;
+		msg.valid = true;
+	}
+	else if (isTimeValid()) {                         // Option 3
+		// TODO Most probably nothing to do
+		log.information("This message has been stored with invalid TS, but now is time valid and I cannot find out origin TS.");
+	}
+	else {                                            // Option 4
+		msg.offset = msg.time - time(NULL);       // Offset won't be negative (it is past, i.e. when that message came)
+		msg.valid = false;
+		log.information("This message has been stored with invalid TS, but now the time is not valid neither - so i can count offset from msg TS and actual TS.");
+	}
+	msg.adapter_id = msg_default.adapter_id;
 }
 
 void Aggregator::printCache(bool verbose) {
-	if (!dist)
+	log.information("Cache contains " + std::to_string(cache.sendableCount()) + " sendable and " + std::to_string(cache.invalidCount()) + " time-invalid messages (" + std::to_string(cache.memoryUsage()) + " bytes)");
+
+	// Listing of thousands of restored messages slows down the startup
+	if (!log.debug())
 		return;
 
 	int i = 0;
-	for (auto item : cache) {
+	cache.forEach([&](const Cache_Item &item) {
+		const IOTMessage &msg = item.msg;
 		i++;
-		if (verbose) {
-			log.information("Cache message (" + std::to_string(i) + "):\n" + dist->convertToXML(item.second) + "\n");
+		if (verbose && dist) {
+			log.debug("Cache message (" + std::to_string(i) + "):\n" + dist->convertToXML(msg) + "\n");
 		}
 		else {
-			std::string val = "--MSG (" + std::to_string(i) + "): ts=" + std::to_string(item.second.time) + ", valid=" + (item.second.valid ? "Y" : "N") + ", offset=" + to_string(item.second.offset) + ", prio=";
-			switch(item.second.priority) {
+			std::string val = "--MSG (" + std::to_string(i) + "): ts=" + std::to_string(msg.time) + ", valid=" + (msg.valid ? "Y" : "N") + ", offset=" + to_string(msg.offset) + ", prio=";
+			switch(msg.priority) {
 				case MSG_PRIO_ACTUATOR:
 					val += "ACT";
 					break;
@@ -532,39 +1179,29 @@ void Aggregator::printCache(bool verbose) {
 					val += "UNK";
 					break;
 			}
-			log.information(val);
+			log.debug(val);
 		}
-	}
+	});
 }
 
 void Aggregator::validateAllMessages(long long int now, long long int duration) {
-	cache_lock->lock();
-	printCache(false);
 	long long int orig_ts = now - duration;    // Timestamp of blackout
 	log.information("Validating messages - now:" + std::to_string(now) + ", duration:" + std::to_string(duration) + ", orig_ts:" +   std::to_string(orig_ts));
 
-	for (std::multimap<Cache_Key, IOTMessage>::iterator it = cache.begin(); it != cache.end(); ++it) {
-		if(!it->second.valid) {
-			it->second.time = orig_ts + it->second.offset;
-			it->second.offset = 0;
-			it->second.valid = true;
-		}
-	}
-	// Store cache after update, computed timestamps are valuable.
-	storeCache();
+	// Timestamps of messages from the blackout are computed when they are taken
+	// from the cache, the journal stores just the beginning of the blackout.
+	cache_lock->lock();
+	cache.resolveBlackout(orig_ts);
+	journal->resolveBlackout(orig_ts);
+	printCache(false);
+	bool changed = updateCacheLevel();
 	cache_lock->unlock();
+	cache_event.set();
+	if (changed)
+		updateBackpressure();
 }
 
 Aggregator::~Aggregator() {
-	if (cache_lock->tryLock(5000)) {;
-		storeCache();
-		cache_lock->unlock();
-	}
-
-	if (cache_lock.get()!=nullptr) {
-		cache_lock->unlock();
-	}
-
 	button_t.join();
 }
 
@@ -10,10 +10,16 @@
 
 extern bool quit_global_flag;
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <map>
+#include <random>
 #include <thread>
 #include <vector>
 
@@ -29,14 +35,19 @@ extern bool quit_global_flag;
 
 #include "Belkin_WeMo.h"
 #include "Bluetooth.h"
+#include "CacheJournal.h"
+#include "ClockWatch.h"
 #include "MQTTDataModule.h"
 #include "Distributor.h"
 #include "LedModule.h"
+#include "MessageCache.h"
 #include "MosqClient.h"
 #include "Parameters.h"
 #include "PressureSensor.h"
+#include "QueueMetrics.h"
 #include "ServerConnector.h"
 #include "TCP.h"
+#include "TokenBucket.h"
 #include "VPT.h"
 #include "VirtualSensorModule.h"
 #include "XMLTool.h"
@@ -44,43 +55,6 @@ extern bool quit_global_flag;
 #include "JablotronModule.h"
 #include "utils.h"
 
-struct Cache_Key {
-
-	Cache_Key() : time(0), priority(MSG_PRIO_HISTORY) {}
-	Cache_Key(MSG_PRIO p, long long int t) : time(t), priority (p) {}
-
-	bool operator<(const Cache_Key& key) const {
-		// The most important is the highest priority
-		if (priority > key.priority)
-			return true;
-		else if (priority < key.priority)
-			return false;
-		else {
-			if (time < key.time)
-				return true;
-			else
-				return false;
-		}
-	}
-
-	bool operator>(const Cache_Key& key) const {
-		if (priority < key.priority)
-			return true;
-		else if (priority > key.priority)
-			return false;
-		else {
-			if (time > key.time)
-				return true;
-			else
-				return false;
-		}
-	}
-
-	long long int time;
-	MSG_PRIO priority;
-};
-
-
 class PanInterface;
 class VirtualSensorModule;
 class Distributor;
@@ -94,8 +68,9 @@ class Bluetooth;
 class TimeWatchdog : public Poco::Runnable {
 	std::chrono::steady_clock::time_point system_start_point;
 	std::chrono::steady_clock::time_point blackout_start_point;
-	bool active;
+	std::atomic<bool> active;     // blackout is measured, read by other threads
 	Aggregator* agg;
+	ClockWatch clock;
 
 public:
 	TimeWatchdog(std::chrono::steady_clock::time_point _start);
@@ -103,14 +78,42 @@ public:
 	bool isActive() { return active; }
 	void setAgg(Aggregator* _agg) { agg = _agg; }
 
-	long long int getOffset() {
-		return (active ? std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - blackout_start_point).count() : 0);
+	/**
+	 * Offset of the given monotonic time point from the beginning of blackout.
+	 */
+	long long int getOffset(std::chrono::steady_clock::time_point at = std::chrono::steady_clock::now()) {
+		if (!active || at < blackout_start_point)
+			return 0;
+		return std::chrono::duration_cast<std::chrono::seconds>(at - blackout_start_point).count();
 	}
 
+	/**
+	 * Start measuring of blackout, it is active before its thread is started.
+	 */
 	void setBlackouStartPoint(std::chrono::steady_clock::time_point _bStart) {
 		blackout_start_point = _bStart;
+		active = true;
 	}
 	void run();
+	void stop() { clock.wakeUp(); }
+};
+
+/**
+ * Message waiting for asynchronous sending to the server.
+ */
+struct Send_Request {
+	IOTMessage msg;
+	std::chrono::steady_clock::time_point submitted;    // monotonic time of sendDataAsync() call
+	std::promise<std::pair<bool, Command>> response;
+};
+
+/**
+ * Load of the Aggregator signalled to modules producing messages, see Aggregator::getBackpressure().
+ */
+enum Backpressure {
+	BACKPRESSURE_NONE = 0,  // messages are sent without delay
+	BACKPRESSURE_SOFT = 1,  // server is not reachable or backlog grows, producers should slow down
+	BACKPRESSURE_HARD = 2   // cache is almost full, producers should poll as rarely as possible
 };
 
 /**
@@ -120,9 +123,14 @@ class Aggregator: public Poco::Runnable {
 public:
 	Aggregator(IOTMessage _msg, std::shared_ptr<MosqClient> _mq);
 	void run();
+	void stop();
 	std::pair<bool, Command> sendData(IOTMessage _msg);
+	std::future<std::pair<bool, Command>> sendDataAsync(IOTMessage _msg);
 	virtual ~Aggregator();
 
+	Backpressure getBackpressure() const { return backpressure; }
+	unsigned int scaleInterval(unsigned int interval) const;
+
 	void setVSM(std::shared_ptr<VirtualSensorModule> _vsm);
 	void setPSM(std::shared_ptr<PressureSensor> _psm);
 	void setLedModule(std::shared_ptr<LedModule> lm);
@@ -134,7 +142,6 @@ public:
 	void setBluetooth(std::shared_ptr<Bluetooth> bluetooth);
 	void setBelkinWemo(std::shared_ptr<Belkin_WeMo> belkinWemo);
 
-	void storeCache();
 	void loadCache(void);
 	void parseCmd(Command cmd);
 	void validateAllMessages(long long int now, long long int duration);
@@ -151,9 +158,10 @@ public:
 
 private:
 	std::unique_ptr<Poco::FastMutex> cache_lock;
-	std::multimap <Cache_Key, IOTMessage> cache;
+	MessageCache cache;
 	Poco::Logger& log;
 	std::unique_ptr<Distributor> dist;
+	std::unique_ptr<CacheJournal> journal;
 
 	std::shared_ptr<PressureSensor> psm;
 	std::shared_ptr<VirtualSensorModule> vsm;
@@ -169,16 +177,69 @@ private:
 
 	std::thread button_t;
 
-	unsigned int cache_minimal_items;
-	unsigned int cache_minimal_time;
-	long long int cache_last_storing_time;
 	std::string permanent_cache_path;
 
 	IOTMessage msg_default;
 	TimeWatchdog watchdog;
+	ClockWatch clock;                     // wakes up the Aggregator thread on change of system time and on exit
 	std::shared_ptr<MosqClient> mq;
 
+	Poco::Event cache_event;              // signalled when a message is cached
+	Poco::Event link_event;               // signalled when the server is reachable again
+	std::atomic<bool> link_healthy;       // result of the last attempt to send a message to the server
+	TokenBucket drain_bucket;             // pacing of cached messages sent to the server
+	unsigned int cache_reconnect_jitter;  // maximal random delay (seconds) of the drain after reconnection
+	unsigned int cache_retry_interval;    // seconds to wait after a failed send of cached message
+	unsigned int cache_batch_size;        // maximum of messages sent in one envelope (1 = no batching)
+	unsigned int cache_batch_timeout;     // milliseconds to wait for more messages to fill the batch
+
+	std::deque<Send_Request> send_queue;  // messages from sendDataAsync()
+	Poco::FastMutex send_lock;
+	Poco::Event send_event;
+	unsigned int send_queue_size;         // maximal number of messages waiting for asynchronous sending
+	unsigned int send_threads;            // number of threads sending messages from sendDataAsync()
+
+	unsigned int cache_drain_window;      // number of cached messages (batches) sent concurrently
+	bool cache_preserialize;              // cached messages carry their serialized <device> element
+	bool cache_compress;                  // sensor readings are compressed in the cache
+
+	std::atomic<Backpressure> backpressure;
+	std::atomic<Backpressure> cache_level;    // backpressure of the cache alone, see updateCacheLevel()
+	std::atomic<Backpressure> queue_level;    // backpressure of the queue alone, see updateQueueLevel()
+	unsigned int backpressure_depth;      // sendable cached messages which start the soft backpressure
+	unsigned int backpressure_soft_factor;    // multiplier of polling intervals under the soft backpressure
+	unsigned int backpressure_hard_factor;    // multiplier of polling intervals under the hard backpressure
+	Poco::FastMutex backpressure_lock;    // lock for combining the levels to backpressure
+
+	QueueMetrics metrics;
+	std::vector<std::unique_ptr<MetricsReporter>> metrics_reporters;
+	unsigned int metrics_interval;        // seconds between reports of queue metrics (0 = disabled)
+
 	void printCache(bool verbose);
+	void runSender();
+	void runDrain();
+	std::pair<bool, Command> deliverData(IOTMessage msg, bool try_send, std::chrono::steady_clock::time_point submitted);
+	void restoreTimestamp(IOTMessage &msg);
+	std::pair<bool, Command> sendToServer(const IOTMessage &msg);
+	bool sendCached(Cache_Item &item);
+	bool sendBatch(std::vector<Cache_Item> &batch);
+	void prepareWire(IOTMessage &msg);
+	void configureLanes(Poco::AutoPtr<Poco::Util::IniFileConfiguration> cfg);
+	void configureTTL(Poco::AutoPtr<Poco::Util::IniFileConfiguration> cfg);
+	void configureMetrics(Poco::AutoPtr<Poco::Util::IniFileConfiguration> cfg);
+	void reportMetrics();
+	void expireCache();
+	bool updateCacheLevel();
+	bool updateQueueLevel();
+	void updateBackpressure();
+	void collectBatch(std::vector<Cache_Item> &batch);
+	void updateLinkState(bool healthy);
+	void updatePacing(const Command &cmd);
+	static bool isAcked(const std::pair<bool, Command> &response, uint64_t seq, int index = -1);
+	void cacheMessage(const IOTMessage &msg);
+	void dropEvicted(const std::vector<Cache_Item> &evicted);
+	void throttleDrain(unsigned int count);
+	void waitForRetry();
 
 };
 
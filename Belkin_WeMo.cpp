@@ -49,7 +49,7 @@ void Belkin_WeMo::parseCmdFromServer(const Command& cmd)
 			sensor.values.push_back({BELKIN_MODULE_ID, BELKIN_SWITCH_STATE_OFF});
 		msg.device = sensor;
 		msg.time = time(NULL);
-		agg->sendData(msg);
+		agg->sendDataAsync(msg);
 	}
 }
 
@@ -166,9 +166,11 @@ void Belkin_WeMo::threadFunction()
 
 		msg.device = sensor;
 		msg.time = time(NULL);
-		agg->sendData(msg);
+		agg->sendDataAsync(msg);
 
-		for(unsigned int i = 0; i < m_wakeUpTime; i++) {
+		// Polling is slowed down while the Aggregator cannot keep up
+		unsigned int interval = agg->scaleInterval(m_wakeUpTime);
+		for(unsigned int i = 0; i < interval; i++) {
 			if(quit_global_flag)
 				break;
 			sleep(1);
@@ -109,7 +109,9 @@ void Bluetooth::threadFunction()
 			m_queries--;
 		}
 
-		for (unsigned int i = 0; i < m_wake_up_time; ++i) {
+		// Polling is slowed down while the Aggregator cannot keep up
+		unsigned int interval = agg->scaleInterval(m_wake_up_time);
+		for (unsigned int i = 0; i < interval; ++i) {
 			if (quit_global_flag)
 				break;
 			sleep(1);
@@ -0,0 +1,565 @@
+/**
+ * @file CacheJournal.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Append-only journal for the persistent cache
+ */
+
+#include <algorithm>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "CacheJournal.h"
+#include "CacheRecord.h"
+#include "Distributor.h"
+
+using namespace std;
+using Poco::FastMutex;
+using Poco::File;
+using Poco::Path;
+
+CacheJournal::CacheJournal(const string &_path, size_t _segment_size, unsigned int _max_segments, unsigned int _flush_interval) :
+	path(_path),
+	segment_size(_segment_size),
+	max_segments(_max_segments),
+	flush_interval(_flush_interval),
+	active_segment(0),
+	active_size(0),
+	file_segment(0),
+	next_id(1),
+	reserved_id(1),
+	durable_id(1),
+	compact_requested(false),
+	written_bytes(0),
+	log(Poco::Logger::get("Adaapp-AGG"))
+{
+	try {
+		replay();
+	}
+	catch (Poco::Exception& ex) {
+		log.error("Failed to load the cache journal: " + ex.displayText());
+	}
+	openSegment(active_segment + 1);
+	reserveIds();
+}
+
+CacheJournal::~CacheJournal() {
+	flush();
+	active.close();
+}
+
+/**
+ * Store new message to the journal.
+ * @param msg Cached message
+ * @return Identifier of the message in the journal
+ */
+uint64_t CacheJournal::append(const IOTMessage &msg) {
+	FastMutex::ScopedLock guard(lock);
+	uint64_t id = takeId();
+
+	live[id] = active_segment;
+	write(CacheRecord(id, msg).encode());
+	return id;
+}
+
+/**
+ * Reserve identifier for a message which is stored later by update() or which
+ * is sent without being journaled.
+ */
+uint64_t CacheJournal::allocateId() {
+	FastMutex::ScopedLock guard(lock);
+	return takeId();
+}
+
+/**
+ * Take the next identifier. Identifiers are reserved on the SD card in advance by
+ * the journal thread (see reserveIds()), it is woken up when the spare block starts
+ * to be used. If it does not keep up, a block is reserved by a queued seq record,
+ * which is written before any record using its identifiers. Lock must be held by the caller.
+ */
+uint64_t CacheJournal::takeId() {
+	if (next_id >= reserved_id) {
+		reserved_id = next_id + JOURNAL_ID_BLOCK;
+		write(CacheRecord(CacheRecord::SEQ, reserved_id).encode());
+	}
+	if (next_id + JOURNAL_ID_BLOCK == durable_id || next_id == durable_id)
+		wake_event.set();
+	return next_id++;
+}
+
+/**
+ * Keep one spare block of identifiers reserved on the SD card, so taking an identifier
+ * never waits for I/O. Called by the journal thread.
+ */
+void CacheJournal::reserveIds() {
+	uint64_t reserved;
+
+	{
+		FastMutex::ScopedLock guard(lock);
+
+		if (reserved_id - next_id <= JOURNAL_ID_BLOCK) {
+			reserved_id = next_id + 2 * JOURNAL_ID_BLOCK;
+			write(CacheRecord(CacheRecord::SEQ, reserved_id).encode());
+		}
+		reserved = reserved_id;
+	}
+	flush();
+
+	FastMutex::ScopedLock guard(lock);
+	durable_id = max(durable_id, reserved);
+}
+
+/**
+ * Store new content of already journaled message (e.g. its timestamp was computed)
+ * or a message with identifier from allocateId().
+ * @param item Cached message with its identifier
+ */
+void CacheJournal::update(const Cache_Item &item) {
+	FastMutex::ScopedLock guard(lock);
+
+	live[item.id] = active_segment;
+	write(CacheRecord(item.id, item.msg).encode());
+}
+
+/**
+ * Mark message as sent, it will not be restored from the journal anymore.
+ * @param id Identifier of the message in the journal
+ */
+void CacheJournal::remove(uint64_t id) {
+	FastMutex::ScopedLock guard(lock);
+
+	if (live.erase(id) == 0)
+		return;
+
+	write(CacheRecord(CacheRecord::DEL, id).encode());
+	if (live.empty())
+		requestCompaction();
+}
+
+/**
+ * Store the beginning of the blackout of time service. Timestamps of all preceding
+ * messages with invalid time are computed from it when the journal is loaded.
+ * @param orig_ts Timestamp of the beginning of the blackout
+ */
+void CacheJournal::resolveBlackout(long long int orig_ts) {
+	FastMutex::ScopedLock guard(lock);
+
+	CacheRecord record(CacheRecord::EPOCH, 0);
+	record.orig_ts = orig_ts;
+	write(record.encode());
+}
+
+/**
+ * Messages which were found in the journal at startup. They are returned only once.
+ */
+vector<Cache_Item> CacheJournal::recovered() {
+	FastMutex::ScopedLock guard(lock);
+
+	vector<Cache_Item> items;
+	items.swap(recovered_items);
+	return items;
+}
+
+/**
+ * Thread function writing records to the SD card and compacting sealed segments.
+ */
+void CacheJournal::run() {
+	while (!quit_global_flag) {
+		wake_event.tryWait(flush_interval);
+
+		try {
+			bool compact_now;
+
+			reserveIds();
+			{
+				FastMutex::ScopedLock guard(lock);
+				compact_now = compact_requested;
+				compact_requested = false;
+			}
+			if (compact_now)
+				compact();
+		}
+		catch (Poco::Exception& ex) {
+			log.error("Writing of the cache journal failed: " + ex.displayText());
+		}
+	}
+	flush();
+}
+
+string CacheJournal::segmentPath(unsigned int segment) const {
+	return path + "." + to_string(segment);
+}
+
+/**
+ * @return Numbers of existing segments in ascending order
+ */
+vector<unsigned int> CacheJournal::listSegments() const {
+	Path prefix(path);
+	string name = prefix.getFileName() + ".";
+	File dir(prefix.parent());
+	vector<string> files;
+	vector<unsigned int> segments;
+
+	if (!dir.exists())
+		return segments;
+
+	dir.list(files);
+	for (const string &file : files) {
+		if (file.compare(0, name.length(), name) != 0 || file.length() == name.length())
+			continue;
+
+		string number = file.substr(name.length());
+		if (number.find_first_not_of("0123456789") != string::npos)
+			continue;
+		segments.push_back(stoul(number));
+	}
+	sort(segments.begin(), segments.end());
+	return segments;
+}
+
+/**
+ * Read records of the segment. Segments are memory mapped, segments in text format
+ * (from older versions) are parsed as CSV.
+ * @param segment Number of segment
+ * @param callback Function called for every record, reading stops when it returns false
+ * @return false if the segment ends with an incomplete record
+ */
+bool CacheJournal::readSegment(unsigned int segment, function<bool(CacheRecord &)> callback) {
+	MappedFile file(segmentPath(segment));
+	CacheRecord record;
+
+	if (!file.valid())
+		return true;
+
+	if (!CacheRecord::hasSegmentHeader(file.data(), file.size())) {
+		ifstream in(segmentPath(segment).c_str());
+		while (readTextRecord(in, record)) {
+			if (!callback(record))
+				return true;
+		}
+		return in.eof();
+	}
+
+	size_t pos = CacheRecord::HEADER_SIZE;
+	while (pos < file.size()) {
+		if (!record.decode(file.data(), file.size(), pos))
+			return false;
+		if (!callback(record))
+			return true;
+	}
+	return true;
+}
+
+/**
+ * Read one record from the segment in text format.
+ * @return false at the end of segment or if the record is incomplete
+ */
+bool CacheJournal::readTextRecord(istream &in, CacheRecord &record) {
+	string line;
+	getline(in, line);
+	if (line.empty() || in.eof())
+		return false;
+
+	size_t type_end = line.find(';');
+	if (type_end == string::npos)
+		return false;
+
+	size_t id_end = line.find(';', type_end + 1);
+	string type = line.substr(0, type_end);
+	long long int id = toIntFromString(line.substr(type_end + 1, id_end == string::npos ? string::npos : id_end - type_end - 1));
+	if (id < 0)
+		return false;
+	record.id = id;
+
+	if (type == "add" && id_end != string::npos) {
+		record.type = CacheRecord::ADD;
+		record.msg = Distributor::convertFromCSV(line.substr(id_end + 1), in);
+	}
+	else if (type == "del") {
+		record.type = CacheRecord::DEL;
+	}
+	else if (type == "base") {
+		record.type = CacheRecord::BASE;
+	}
+	else {
+		return false;
+	}
+
+	// The last record might be incomplete after power failure
+	return !in.fail() && !in.eof();
+}
+
+/**
+ * Load live messages from all segments. Segments older than the last compacted
+ * segment are not needed anymore and they are removed. Segments in text format
+ * are converted to a new binary segment.
+ */
+void CacheJournal::replay() {
+	vector<unsigned int> segments = listSegments();
+	map<uint64_t, IOTMessage> items;
+	vector<uint64_t> unresolved;
+	bool text_format = false;
+
+	auto first = segments.begin();
+	for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+		bool base = false;
+		readSegment(*it, [&](CacheRecord &record) {
+			base = (record.type == CacheRecord::BASE);
+			return false;
+		});
+		if (base) {
+			first = it.base() - 1;
+			break;
+		}
+	}
+	if (first != segments.end())
+		removeSegmentsBefore(*first);
+
+	for (auto it = first; it != segments.end(); ++it) {
+		unsigned int segment = *it;
+		MappedFile file(segmentPath(segment));
+		text_format |= file.valid() && !CacheRecord::hasSegmentHeader(file.data(), file.size());
+
+		bool complete = readSegment(segment, [&](CacheRecord &record) {
+			next_id = max(next_id, (record.type == CacheRecord::SEQ) ? record.id : record.id + 1);
+
+			if (record.type == CacheRecord::ADD) {
+				items[record.id] = record.msg;
+				live[record.id] = segment;
+				if (!record.msg.valid)
+					unresolved.push_back(record.id);
+			}
+			else if (record.type == CacheRecord::DEL) {
+				items.erase(record.id);
+				live.erase(record.id);
+			}
+			else if (record.type == CacheRecord::EPOCH) {
+				for (uint64_t id : unresolved) {
+					auto item = items.find(id);
+					if (item != items.end() && !item->second.valid)
+						resolveTimestamp(item->second, record.orig_ts);
+				}
+				unresolved.clear();
+			}
+			return true;
+		});
+		if (!complete)
+			log.warning("Incomplete record in the cache journal \"" + segmentPath(segment) + "\" - ignoring the rest of segment.");
+
+		active_segment = segment;
+	}
+
+	// Identifiers of the last reserved block might have been used, they are skipped
+	reserved_id = next_id;
+	durable_id = next_id;
+
+	for (auto &item : items)
+		recovered_items.push_back(Cache_Item(item.first, item.second));
+
+	if (!segments.empty())
+		log.information("Loaded " + to_string(recovered_items.size()) + " messages from the cache journal.");
+
+	if (text_format) {
+		log.information("Converting the cache journal to binary format.");
+		unsigned int segment = active_segment + 1;
+
+		openSegment(segment);
+		write(CacheRecord(CacheRecord::BASE, segment).encode());
+		write(CacheRecord(CacheRecord::SEQ, reserved_id).encode());
+		for (auto &item : recovered_items) {
+			live[item.id] = active_segment;
+			write(CacheRecord(item.id, item.msg).encode());
+		}
+		flush();
+		removeSegmentsBefore(segment);
+	}
+}
+
+/**
+ * Start a new active segment. Its file is created when the first record is written.
+ * Lock must be held by the caller.
+ */
+void CacheJournal::openSegment(unsigned int segment) {
+	active_segment = segment;
+	active_size = CacheRecord::HEADER_SIZE;
+}
+
+/**
+ * Append data to the active segment. Data are only queued in memory, they are
+ * written to the SD card by flush(). Lock must be held by the caller.
+ */
+void CacheJournal::write(const string &data) {
+	if (pending.empty() || pending.back().first != active_segment)
+		pending.push_back(make_pair(active_segment, string()));
+	pending.back().second += data;
+	active_size += data.length();
+
+	if (active_size >= segment_size) {
+		openSegment(active_segment + 1);
+		requestCompaction();
+	}
+}
+
+/**
+ * Wake up the journal thread to compact sealed segments. Lock must be held by the caller.
+ */
+void CacheJournal::requestCompaction() {
+	compact_requested = true;
+	wake_event.set();
+}
+
+/**
+ * Write queued records to their segments.
+ */
+void CacheJournal::flush() {
+	FastMutex::ScopedLock file_guard(file_lock);
+	writePending();
+}
+
+/**
+ * Write queued records to their segments. File lock must be held by the caller.
+ */
+void CacheJournal::writePending() {
+	vector<pair<unsigned int, string>> chunks;
+
+	{
+		FastMutex::ScopedLock guard(lock);
+		chunks.swap(pending);
+	}
+
+	for (auto &chunk : chunks) {
+		if (chunk.first != file_segment || !active.is_open()) {
+			active.close();
+			active.clear();
+			active.open(segmentPath(chunk.first).c_str(), ios::out | ios::trunc | ios::binary);
+			if (!active.good())
+				log.error("Cannot open cache journal segment \"" + segmentPath(chunk.first) + "\"");
+
+			file_segment = chunk.first;
+			active << CacheRecord::segmentHeader();
+			written_bytes += CacheRecord::segmentHeader().length();
+		}
+		active << chunk.second;
+		written_bytes += chunk.second.length();
+	}
+	if (!chunks.empty())
+		active.flush();
+}
+
+/**
+ * Copy live messages from all sealed segments to a new segment which replaces them.
+ * It is done only when there is too many sealed segments or none of them contains
+ * a live message.
+ */
+void CacheJournal::compact() {
+	FastMutex::ScopedLock file_guard(file_lock);
+	map<uint64_t, unsigned int> snapshot;
+	vector<unsigned int> sealed;
+	uint64_t next_seq;
+
+	{
+		FastMutex::ScopedLock guard(lock);
+
+		// Only segments preceding the one being written are complete on the SD card
+		for (unsigned int segment : listSegments()) {
+			if (segment < active_segment && segment < file_segment)
+				sealed.push_back(segment);
+		}
+		if (sealed.empty())
+			return;
+		next_seq = reserved_id;
+
+		for (auto &item : live) {
+			if (item.second <= sealed.back())
+				snapshot.insert(item);
+		}
+	}
+
+	unsigned int last = sealed.back();
+	if (snapshot.empty()) {
+		// The reserved identifiers must survive removal of all sealed segments
+		{
+			FastMutex::ScopedLock guard(lock);
+			write(CacheRecord(CacheRecord::SEQ, reserved_id).encode());
+		}
+		writePending();
+		removeSegmentsBefore(last + 1);
+		return;
+	}
+	if (sealed.size() <= max_segments)
+		return;
+
+	log.information("Compacting " + to_string(sealed.size()) + " segments of the cache journal with " + to_string(snapshot.size()) + " live messages.");
+
+	string tmp_path = segmentPath(last) + ".tmp";
+	ofstream out(tmp_path.c_str(), ios::out | ios::trunc | ios::binary);
+	out << CacheRecord::segmentHeader();
+	out << CacheRecord(CacheRecord::BASE, last).encode();
+	out << CacheRecord(CacheRecord::SEQ, next_seq).encode();
+
+	// Messages with invalid time are copied with timestamps resolved by following epochs
+	map<uint64_t, CacheRecord> copied;
+	vector<uint64_t> unresolved;
+	for (unsigned int segment : sealed) {
+		readSegment(segment, [&](CacheRecord &record) {
+			if (record.type == CacheRecord::EPOCH) {
+				for (uint64_t id : unresolved) {
+					if (!copied[id].msg.valid)
+						resolveTimestamp(copied[id].msg, record.orig_ts);
+				}
+				unresolved.clear();
+			}
+			if (record.type != CacheRecord::ADD)
+				return true;
+
+			auto it = snapshot.find(record.id);
+			if (it != snapshot.end() && it->second == segment) {
+				copied[record.id] = record;
+				if (!record.msg.valid)
+					unresolved.push_back(record.id);
+			}
+			return true;
+		});
+	}
+	for (auto &record : copied)
+		out << record.second.encode();
+	streamoff written = out.tellp();
+	if (written > 0)
+		written_bytes += written;
+	out.close();
+	if (out.fail())
+		throw Poco::IOException("cannot write " + tmp_path);
+
+	File(tmp_path).renameTo(segmentPath(last));
+	removeSegmentsBefore(last);
+
+	FastMutex::ScopedLock guard(lock);
+	for (auto &item : snapshot) {
+		auto it = live.find(item.first);
+		if (it != live.end() && it->second == item.second)
+			it->second = last;
+	}
+}
+
+/**
+ * Compute timestamp of the message stored during a blackout.
+ */
+void CacheJournal::resolveTimestamp(IOTMessage &msg, long long int orig_ts) {
+	msg.time = orig_ts + msg.offset;
+	msg.offset = 0;
+	msg.valid = true;
+}
+
+void CacheJournal::removeSegmentsBefore(unsigned int segment) {
+	for (unsigned int s : listSegments()) {
+		if (s >= segment)
+			break;
+		try {
+			File(segmentPath(s)).remove();
+		}
+		catch (Poco::Exception& ex) {
+			log.error("Cannot remove cache journal segment: " + ex.displayText());
+		}
+	}
+}
@@ -0,0 +1,98 @@
+/**
+ * @file CacheJournal.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Append-only journal for the persistent cache
+ */
+
+#ifndef CACHEJOURNAL_H
+#define	CACHEJOURNAL_H
+
+extern bool quit_global_flag;
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <Poco/Event.h>
+#include <Poco/Logger.h>
+#include <Poco/Mutex.h>
+#include <Poco/Runnable.h>
+
+#include "CacheRecord.h"
+#include "MessageCache.h"
+#include "utils.h"
+
+#define JOURNAL_ID_BLOCK 1024 // identifiers reserved by one seq record
+
+/**
+ * Persistent cache stored as a sequence of append-only segments with binary records
+ * (see CacheRecord). Every cached message is appended once (add record) and every
+ * sent message is marked by a tombstone (del record). When the active segment
+ * reaches its maximal size, a new one is started. Records are queued in memory
+ * and written to the SD card by the journal thread, so callers never wait for I/O.
+ * Sealed segments are compacted in the journal thread - live messages are copied
+ * to a new segment which supersedes all the older ones. Identifiers of messages
+ * are their sequence numbers, they keep increasing across restarts. They are
+ * reserved in blocks by seq records written by the journal thread ahead of their use,
+ * so even identifiers of messages which were never journaled are not reused.
+ */
+class CacheJournal : public Poco::Runnable {
+public:
+	CacheJournal(const std::string &_path, std::size_t _segment_size, unsigned int _max_segments, unsigned int _flush_interval);
+	~CacheJournal();
+
+	uint64_t append(const IOTMessage &msg);
+	uint64_t allocateId();
+	void update(const Cache_Item &item);
+	void remove(uint64_t id);
+	void resolveBlackout(long long int orig_ts);
+	std::vector<Cache_Item> recovered();
+	uint64_t writtenBytes() const { return written_bytes; }
+	void flush();
+	void run();
+
+private:
+	std::string segmentPath(unsigned int segment) const;
+	std::vector<unsigned int> listSegments() const;
+	bool readSegment(unsigned int segment, std::function<bool(CacheRecord &)> callback);
+	bool readTextRecord(std::istream &in, CacheRecord &record);
+	void replay();
+	uint64_t takeId();
+	void reserveIds();
+	void openSegment(unsigned int segment);
+	void write(const std::string &data);
+	void requestCompaction();
+	void writePending();
+	void compact();
+	void removeSegmentsBefore(unsigned int segment);
+	static void resolveTimestamp(IOTMessage &msg, long long int orig_ts);
+
+	std::string path;                          // path prefix of segments, number of segment is appended
+	std::size_t segment_size;                  // size of segment (bytes) which causes start of a new one
+	unsigned int max_segments;                 // number of sealed segments which starts the compaction
+	unsigned int flush_interval;               // milliseconds between writes of queued records
+
+	Poco::FastMutex lock;                      // lock for active segment, queued records and live messages
+	Poco::FastMutex file_lock;                 // lock for segment files, held while writing and compacting
+	Poco::Event wake_event;                    // wakes up the journal thread to reserve identifiers or compact
+	std::ofstream active;                      // file of the segment being written
+	unsigned int active_segment;
+	std::size_t active_size;
+	unsigned int file_segment;                 // number of the segment being written
+	std::vector<std::pair<unsigned int, std::string>> pending;   // records waiting for write (segment, data)
+	uint64_t next_id;
+	uint64_t reserved_id;                      // identifiers below it are reserved by the last queued seq record
+	uint64_t durable_id;                       // identifiers below it are reserved by a seq record on the SD card
+	bool compact_requested;                    // sealed segments should be compacted
+	std::map<uint64_t, unsigned int> live;     // id of live message -> segment with its add record
+	std::vector<Cache_Item> recovered_items;   // messages loaded from the journal at startup
+	std::atomic<uint64_t> written_bytes;       // bytes written to the SD card (including compaction)
+
+	Poco::Logger& log;
+};
+
+#endif	/* CACHEJOURNAL_H */
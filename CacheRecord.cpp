@@ -0,0 +1,213 @@
+/**
+ * @file CacheRecord.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Binary format of records in the cache journal
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Poco/Checksum.h>
+
+#include "CacheRecord.h"
+
+using namespace std;
+using Poco::Checksum;
+
+#define CACHE_RECORD_MAGIC "BCJ"
+#define CACHE_RECORD_MAX_SIZE (1 << 20)
+
+static void putInt(string &out, uint64_t value, unsigned int bytes) {
+	for (unsigned int i = 0; i < bytes; i++)
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+static void putString(string &out, const string &value) {
+	size_t length = min<size_t>(value.length(), 0xffff);
+	putInt(out, length, 2);
+	out.append(value, 0, length);
+}
+
+static uint32_t checksum(const char *data, size_t size) {
+	Checksum crc(Checksum::TYPE_CRC32);
+	crc.update(data, size);
+	return crc.checksum();
+}
+
+/**
+ * Bounds checked reader of the record payload.
+ */
+struct RecordReader {
+	RecordReader(const char *_data, size_t _size) : data(_data), size(_size), pos(0), ok(true) {}
+
+	uint64_t getInt(unsigned int bytes) {
+		uint64_t value = 0;
+		if (!ok || size - pos < bytes) {
+			ok = false;
+			return 0;
+		}
+		for (unsigned int i = 0; i < bytes; i++)
+			value |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+		pos += bytes;
+		return value;
+	}
+
+	string getString() {
+		size_t length = getInt(2);
+		if (!ok || size - pos < length) {
+			ok = false;
+			return "";
+		}
+		string value(data + pos, length);
+		pos += length;
+		return value;
+	}
+
+	const char *data;
+	size_t size;
+	size_t pos;
+	bool ok;
+};
+
+string CacheRecord::encode() const {
+	string payload;
+
+	putInt(payload, type, 1);
+	putInt(payload, id, 8);
+	if (type == ADD) {
+		putInt(payload, msg.time, 8);
+		putInt(payload, msg.offset, 8);
+		putInt(payload, msg.tt_version, 8);
+		putInt(payload, msg.priority, 1);
+		putInt(payload, msg.valid ? 1 : 0, 1);
+		putString(payload, msg.state);
+		putString(payload, msg.fw_version);
+		putString(payload, msg.protocol_version);
+		putInt(payload, msg.device.euid, 8);
+		putInt(payload, msg.device.device_id, 8);
+		putInt(payload, msg.device.version, 4);
+		putString(payload, msg.device.name);
+		putInt(payload, msg.device.values.size(), 2);
+		for (const Value &value : msg.device.values) {
+			uint32_t bits;
+			memcpy(&bits, &value.value, sizeof(bits));
+			putInt(payload, value.mid, 4);
+			putInt(payload, bits, 4);
+			putInt(payload, value.status ? 1 : 0, 1);
+		}
+	}
+	else if (type == EPOCH) {
+		putInt(payload, orig_ts, 8);
+	}
+
+	string record;
+	putInt(record, payload.length(), 4);
+	putInt(record, checksum(payload.data(), payload.length()), 4);
+	record.append(payload);
+	return record;
+}
+
+/**
+ * Decode record at the given position.
+ * @param data Content of the segment
+ * @param size Size of the segment
+ * @param pos Position of the record, moved behind the record on success
+ * @return false if there is no complete and valid record at the position
+ */
+bool CacheRecord::decode(const char *data, size_t size, size_t &pos) {
+	RecordReader header(data + pos, size - pos);
+	size_t length = header.getInt(4);
+	uint32_t crc = header.getInt(4);
+
+	if (!header.ok || length > CACHE_RECORD_MAX_SIZE || size - pos - header.pos < length)
+		return false;
+
+	const char *payload = data + pos + header.pos;
+	if (checksum(payload, length) != crc)
+		return false;
+
+	RecordReader in(payload, length);
+	type = static_cast<Type>(in.getInt(1));
+	id = in.getInt(8);
+	if (type == ADD) {
+		msg = IOTMessage();
+		msg.seq = id;
+		msg.time = in.getInt(8);
+		msg.offset = in.getInt(8);
+		msg.tt_version = in.getInt(8);
+		msg.priority = static_cast<MSG_PRIO>(in.getInt(1));
+		msg.valid = in.getInt(1) != 0;
+		msg.state = in.getString();
+		msg.fw_version = in.getString();
+		msg.protocol_version = in.getString();
+		msg.device.euid = in.getInt(8);
+		msg.device.device_id = in.getInt(8);
+		msg.device.version = in.getInt(4);
+		msg.device.name = in.getString();
+
+		unsigned int count = in.getInt(2);
+		for (unsigned int i = 0; i < count && in.ok; i++) {
+			int mid = static_cast<int32_t>(in.getInt(4));
+			uint32_t bits = in.getInt(4);
+			bool status = in.getInt(1) != 0;
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			msg.device.values.push_back(Value(mid, value, status));
+		}
+		msg.device.pairs = msg.device.values.size();
+	}
+	else if (type == EPOCH) {
+		orig_ts = in.getInt(8);
+	}
+	else if (type != DEL && type != BASE && type != SEQ) {
+		return false;
+	}
+
+	if (!in.ok)
+		return false;
+
+	pos += header.pos + length;
+	return true;
+}
+
+string CacheRecord::segmentHeader() {
+	string header(CACHE_RECORD_MAGIC, 4);
+	putInt(header, CACHE_RECORD_VERSION, 2);
+	putInt(header, 0, 2);
+	return header;
+}
+
+bool CacheRecord::hasSegmentHeader(const char *data, size_t size) {
+	string header = segmentHeader();
+	return size >= HEADER_SIZE && memcmp(data, header.data(), HEADER_SIZE) == 0;
+}
+
+MappedFile::MappedFile(const string &path) :
+	addr(NULL),
+	length(0)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			addr = mapped;
+			length = info.st_size;
+		}
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (addr != NULL)
+		munmap(addr, length);
+}
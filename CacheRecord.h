@@ -0,0 +1,70 @@
+/**
+ * @file CacheRecord.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Binary format of records in the cache journal
+ */
+
+#ifndef CACHERECORD_H
+#define	CACHERECORD_H
+
+#include <string>
+
+#include "utils.h"
+
+#define CACHE_RECORD_VERSION 1
+
+/**
+ * Record of the cache journal. Every segment of the journal starts with a header
+ * (magic and format version) followed by records. Record consists of length
+ * and CRC32 of its payload, payload contains type, id (sequence number of the message) and the message (ADD records)
+ * or the beginning of the blackout (EPOCH records). All numbers are stored in little endian.
+ */
+struct CacheRecord {
+	enum Type {
+		NONE = 0,
+		ADD  = 1,       // cached message
+		DEL  = 2,       // tombstone of sent message
+		BASE = 3,       // segment supersedes all older segments
+		EPOCH = 4,      // end of blackout, resolves timestamps of all preceding messages with invalid time
+		SEQ  = 5        // next sequence number, keeps sequence numbers increasing when older segments are removed
+	};
+
+	CacheRecord() : type(NONE), id(0), orig_ts(0) {}
+	CacheRecord(Type _type, uint64_t _id) : type(_type), id(_id), orig_ts(0) {}
+	CacheRecord(uint64_t _id, const IOTMessage &_msg) : type(ADD), id(_id), msg(_msg), orig_ts(0) {}
+
+	std::string encode() const;
+	bool decode(const char *data, std::size_t size, std::size_t &pos);
+
+	static std::string segmentHeader();
+	static bool hasSegmentHeader(const char *data, std::size_t size);
+	static const std::size_t HEADER_SIZE = 8;
+
+	Type type;
+	uint64_t id;
+	IOTMessage msg;
+	long long int orig_ts;  // beginning of the blackout (EPOCH record)
+};
+
+/**
+ * Read-only memory mapping of the whole file.
+ */
+class MappedFile {
+public:
+	MappedFile(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool valid() const { return addr != NULL; }
+	const char *data() const { return static_cast<const char *>(addr); }
+	std::size_t size() const { return length; }
+
+private:
+	void *addr;
+	std::size_t length;
+};
+
+#endif	/* CACHERECORD_H */
@@ -0,0 +1,105 @@
+/**
+ * @file ClockWatch.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Notification about changes of the system time
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "ClockWatch.h"
+
+#define CLOCKWATCH_POLL_TIMEOUT 5000 // milliseconds, only without timerfd
+
+// Missing in headers of older C libraries (available since Linux 3.0)
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+
+ClockWatch::ClockWatch() :
+	fd(-1),
+	wakeup_fd(-1),
+	log(Poco::Logger::get("Adaapp-AGG"))
+{
+	fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0 || !arm()) {
+		log.warning("Changes of system time cannot be watched: " + std::string(strerror(errno)));
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+
+	wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeup_fd < 0)
+		log.warning("Waiting for change of system time cannot be interrupted: " + std::string(strerror(errno)));
+}
+
+ClockWatch::~ClockWatch() {
+	if (fd >= 0)
+		close(fd);
+	if (wakeup_fd >= 0)
+		close(wakeup_fd);
+}
+
+/**
+ * Set the timer to expire in far future, only a change of the system time cancels it.
+ */
+bool ClockWatch::arm() {
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = INT32_MAX;
+
+	return timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) == 0;
+}
+
+/**
+ * Wait until the system time is set, wakeUp() is called or the timeout expires.
+ * @param timeout Timeout in milliseconds (negative = none, limited without timerfd)
+ * @return true if the system time was set
+ */
+bool ClockWatch::waitForChange(int timeout) {
+	struct pollfd pfd[2];
+
+	if (fd < 0 && (timeout < 0 || timeout > CLOCKWATCH_POLL_TIMEOUT))
+		timeout = CLOCKWATCH_POLL_TIMEOUT;
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = wakeup_fd;
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+
+	// Negative descriptors are ignored by poll()
+	if (poll(pfd, 2, timeout) <= 0)
+		return false;
+
+	uint64_t value;
+	if (pfd[1].revents != 0 && read(wakeup_fd, &value, sizeof(value)) < 0)
+		log.error("Cannot read wakeup of clock watch: " + std::string(strerror(errno)));
+
+	if (pfd[0].revents != 0 && read(fd, &value, sizeof(value)) < 0 && errno == ECANCELED) {
+		arm();
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Interrupt the waiting thread, or the next wait when no thread is waiting.
+ */
+void ClockWatch::wakeUp() {
+	if (wakeup_fd < 0)
+		return;
+
+	uint64_t value = 1;
+	if (write(wakeup_fd, &value, sizeof(value)) < 0)
+		log.error("Cannot wake up clock watch: " + std::string(strerror(errno)));
+}
@@ -0,0 +1,38 @@
+/**
+ * @file ClockWatch.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Notification about changes of the system time
+ */
+
+#ifndef CLOCKWATCH_H
+#define	CLOCKWATCH_H
+
+#include <Poco/Logger.h>
+
+/**
+ * Wait for a change of the system time (e.g. when NTP sets the time). It is based on timerfd
+ * with TFD_TIMER_CANCEL_ON_SET, which is cancelled by the kernel when CLOCK_REALTIME is set.
+ * The wait is interrupted by wakeUp() (eventfd), e.g. on exit of the application. When timerfd
+ * is not available, the wait is limited by a timeout, so the caller can check the time.
+ */
+class ClockWatch {
+public:
+	ClockWatch();
+	~ClockWatch();
+
+	ClockWatch(const ClockWatch&) = delete;
+	ClockWatch& operator=(const ClockWatch&) = delete;
+
+	bool waitForChange(int timeout = -1);
+	void wakeUp();
+
+private:
+	bool arm();
+
+	int fd;
+	int wakeup_fd;
+	Poco::Logger& log;
+};
+
+#endif	/* CLOCKWATCH_H */
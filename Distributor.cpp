@@ -13,6 +13,7 @@ using namespace std;
 using Poco::AutoPtr;
 using Poco::FastMutex;
 using Poco::Logger;
+using Poco::StringTokenizer;
 using Poco::Util::IniFileConfiguration;
 
 void Distributor::run() {
@@ -167,6 +168,78 @@ std::string Distributor::convertToCSV(IOTMessage msg, bool full_format) {
 	return ret;
 }
 
+/**
+ * Parse message in full CSV format created by convertToCSV().
+ * @param line First line of the message (header with the number of pairs)
+ * @param values Stream with the lines of values, one line per pair is consumed
+ * @return Parsed message
+ */
+IOTMessage Distributor::convertFromCSV(const std::string &line, std::istream &values) {
+	Logger& log = Logger::get("Adaapp-DIST");
+	IOTMessage msg;
+
+	StringTokenizer token(line, (std::string)";", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+	for (unsigned int i = 0; i + 1 < (unsigned int)token.count();) {
+		if (token[i].compare("time") == 0)
+			msg.time = toIntFromString(token[i+1]);
+
+		else if (token[i].compare("euid") == 0)
+			msg.device.euid = stoull(token[i+1], nullptr, 0);
+
+		else if (token[i].compare("device_id") == 0)
+			msg.device.device_id = toIntFromString(token[i+1]);
+
+		else if (token[i].compare("dev_version") == 0)
+			msg.device.version = toIntFromString(token[i+1]);
+
+		else if (token[i].compare("valid") == 0)
+			msg.valid = (token[i+1].compare("yes") == 0) ? true : false;
+
+		else if (token[i].compare("state") == 0)
+			msg.state = token[i+1];
+
+		else if (token[i].compare("fw_version") == 0)
+			msg.fw_version = token[i+1];
+
+		else if (token[i].compare("protocol_version") == 0)
+			msg.protocol_version = token[i+1];
+
+		else if (token[i].compare("pairs") == 0)
+			msg.device.pairs = atoi(token[i+1].c_str());
+
+		else if (token[i].compare("tt_version") == 0)
+			msg.tt_version = toIntFromString(token[i+1]);
+
+		else {
+			log.information("Unknown type of token name: " + token[i]);
+		}
+		i+=2;
+	}
+	for (int i = 0; i < msg.device.pairs; i++) {
+		std::string pair_line;
+		std::getline(values, pair_line);
+		StringTokenizer token2(pair_line, (std::string)";", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+		int module_id = 0;
+		float value = 0;
+		bool status = true;
+
+		for (unsigned int i = 0; i + 1 < (unsigned int)token2.count(); ) {
+			if (token2[i].compare("module_id") == 0)
+				module_id = toNumFromString(token2[i+1]);
+			else if (token2[i].compare("value") == 0)
+				value = toFloatFromString(token2[i+1]);
+			else if (token2[i].compare("status") == 0)
+				status = (token2[i+1].compare("unavailable") != 0);
+			else {
+				log.information("Unknown type of token name: " + token2[i]);
+			}
+			i = i+2;
+		}
+		msg.device.values.push_back({module_id, value, status});
+	}
+	return msg;
+}
+
 std::string Distributor::convertToXML(IOTMessage msg) {
 	std::string ret;
 
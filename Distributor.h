@@ -50,7 +50,8 @@ class Distributor: public Poco::Runnable {
 		~Distributor();
 
 		// Convert functions
-		std::string convertToCSV (IOTMessage msg, bool full_format);
+		static std::string convertToCSV (IOTMessage msg, bool full_format);
+		static IOTMessage convertFromCSV (const std::string &line, std::istream &values);
 		std::string convertToXML (IOTMessage msg);
 		std::string convertToPlainText (IOTMessage);
 
@@ -0,0 +1,123 @@
+/**
+ * @file FrameParser.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Extraction of delimited messages from a stream of the server
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "FrameParser.h"
+
+using namespace std;
+
+/**
+ * @param max_frame Maximal length of message without its delimiter
+ * @param _delimiter Character terminating every message
+ */
+FrameParser::FrameParser(size_t max_frame, char _delimiter) :
+	buffer(max_frame + 1),
+	delimiter(_delimiter),
+	head(0),
+	used(0),
+	scanned(0),
+	discarding(false)
+{
+}
+
+/**
+ * Free space of the buffer for receiving of data, the space is contiguous.
+ * @param data Beginning of the free space
+ * @return Size of the free space (0 if the buffer is full)
+ */
+size_t FrameParser::space(char *&data) {
+	size_t tail = (head + used) % buffer.size();
+
+	data = &buffer[tail];
+	if (used == buffer.size())
+		return 0;
+	return (tail >= head) ? buffer.size() - tail : head - tail;
+}
+
+/**
+ * Add data written to the free space to the buffer.
+ */
+void FrameParser::commit(size_t length) {
+	used += length;
+}
+
+void FrameParser::clear() {
+	head = 0;
+	used = 0;
+	scanned = 0;
+	discarding = false;
+}
+
+/**
+ * Find the next complete message. When the buffer is full without any delimiter,
+ * its content is dropped and so is the rest of the message up to its delimiter.
+ * @param dropped Incremented for every message dropped because of its size
+ * @return false if there is no complete message
+ */
+bool FrameParser::next(const char *&frame, size_t &length, unsigned int &dropped) {
+	while (true) {
+		bool found = false;
+
+		// Scan only the bytes received since the last call, in at most two segments
+		while (scanned < used) {
+			size_t position = (head + scanned) % buffer.size();
+			size_t chunk = min(used - scanned, buffer.size() - position);
+			const char *hit = static_cast<const char *>(memchr(&buffer[position], delimiter, chunk));
+
+			if (hit != NULL) {
+				scanned += hit - &buffer[position];
+				found = true;
+				break;
+			}
+			scanned += chunk;
+		}
+
+		if (!found) {
+			if (used == buffer.size()) {
+				if (!discarding)
+					dropped++;
+				discarding = true;
+				head = 0;
+				used = 0;
+				scanned = 0;
+			}
+			return false;
+		}
+
+		if (discarding) {
+			discarding = false;
+			consume(scanned + 1);
+			continue;
+		}
+
+		length = scanned;
+		if (head + length <= buffer.size()) {
+			frame = &buffer[head];
+		}
+		else {
+			wrapped.assign(&buffer[head], buffer.size() - head);
+			wrapped.append(&buffer[0], length - (buffer.size() - head));
+			frame = wrapped.data();
+		}
+		return true;
+	}
+}
+
+/**
+ * Remove processed bytes from the beginning of the buffer.
+ */
+void FrameParser::consume(size_t length) {
+	head = (head + length) % buffer.size();
+	used -= length;
+	scanned = 0;
+
+	// Empty buffer starts from its beginning, so the free space is as large as possible
+	if (used == 0)
+		head = 0;
+}
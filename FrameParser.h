@@ -0,0 +1,90 @@
+/**
+ * @file FrameParser.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Extraction of delimited messages from a stream of the server
+ */
+
+#ifndef FRAMEPARSER_H
+#define	FRAMEPARSER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define FRAME_MAX_SIZE 65536 // bytes
+
+/**
+ * Messages of the server are separated by NULL byte. Received data are written
+ * directly to a ring buffer of fixed size (see space() and commit()) and complete
+ * messages are passed to the caller without copying, only a message wrapped around
+ * the end of the buffer is copied. Every byte is scanned for the delimiter once.
+ * Message longer than the maximal size is dropped up to its delimiter. Data which
+ * cannot be received directly to the buffer (e.g. WebSocket frames, which have to be
+ * read at once) are copied to it by feed().
+ */
+class FrameParser {
+public:
+	FrameParser(std::size_t max_frame = FRAME_MAX_SIZE, char _delimiter = '\0');
+
+	std::size_t space(char *&data);
+	void commit(std::size_t length);
+	void clear();
+	std::size_t size() const { return used; }
+
+	/**
+	 * Call the given function for every complete message in the buffer. The message
+	 * is valid only during the call of function(const char *data, std::size_t length).
+	 * @return Number of messages dropped because of their size
+	 */
+	template <typename Function>
+	unsigned int extract(Function f) {
+		unsigned int dropped = 0;
+		const char *frame;
+		std::size_t length;
+
+		while (next(frame, length, dropped)) {
+			f(frame, length);
+			consume(length + 1);
+		}
+		return dropped;
+	}
+
+	/**
+	 * Copy received data to the buffer and call the given function for every complete
+	 * message like extract(). Data larger than the free space are copied in parts.
+	 * @return Number of messages dropped because of their size
+	 */
+	template <typename Function>
+	unsigned int feed(const char *data, std::size_t length, Function f) {
+		unsigned int dropped = 0;
+
+		while (length > 0) {
+			char *free;
+			std::size_t chunk = std::min(space(free), length);
+
+			std::memcpy(free, data, chunk);
+			commit(chunk);
+			data += chunk;
+			length -= chunk;
+			dropped += extract(f);
+		}
+		return dropped;
+	}
+
+private:
+	bool next(const char *&frame, std::size_t &length, unsigned int &dropped);
+	void consume(std::size_t length);
+
+	std::vector<char> buffer;
+	char delimiter;
+	std::size_t head;       // position of the first unprocessed byte
+	std::size_t used;       // number of unprocessed bytes
+	std::size_t scanned;    // unprocessed bytes known not to contain the delimiter
+	bool discarding;        // the first message in the buffer is too long, it is dropped
+	std::string wrapped;    // copy of message wrapped around the end of buffer
+};
+
+#endif	/* FRAMEPARSER_H */
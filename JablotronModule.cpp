@@ -121,7 +121,7 @@ void JablotronModule::threadFunction()
 
 /**
  * Your event has been set but it is necessary to off what is achieved by adding
- * value to sensorEvent.values. First, send a message with Eventim agg->sendData(msg),
+ * value to sensorEvent.values. First, send a message with Eventim agg->sendDataAsync(msg),
  * you need to change to not have the same timestamp (+2).
  */
 bool JablotronModule::sendMessageToServer(TJablotron &jablotron_msg,
@@ -137,13 +137,13 @@ bool JablotronModule::sendMessageToServer(TJablotron &jablotron_msg,
 		return false;
 
 	msg.device = sensor;
-	agg->sendData(msg);
+	agg->sendDataAsync(msg);
 
 	if (event) {
 		usleep(DELAY_BEETWEEN_CYCLES);
 		msg.device = sensorEvent;
 		msg.time += TIME_BETWEEN_RESET_EVENT;
-		agg->sendData(msg);
+		agg->sendDataAsync(msg);
 		event = false;
 	}
 
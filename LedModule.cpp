@@ -76,7 +76,7 @@ void LedModule::threadFunction()
 			ioMessage.setLedConf(answerFromDaemon.getLedConf());
 			createServerMsg(ioMessage);
 			response = agg->sendData(msg);
-			if (response.first)
+			if (response.first && !response.second.state.empty())
 				parseCmdFromServer(response.second);
 		}
 	}
@@ -0,0 +1,796 @@
+/**
+ * @file MessageCache.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Cache for messages which could not be sent to the server
+ */
+
+#include <climits>
+
+#include "MessageCache.h"
+
+using namespace std;
+
+// Strings up to this length are stored inside std::string without allocation
+#define STRING_SSO_CAPACITY 15
+// Pointers and color of a node of the red-black tree
+#define INDEX_NODE_OVERHEAD (4 * sizeof(void *))
+
+static size_t stringFootprint(const string &str) {
+	return str.capacity() > STRING_SSO_CAPACITY ? str.capacity() + 1 : 0;
+}
+
+/**
+ * Insert message to the index according to its validity. Message with invalid
+ * timestamp belongs to the current blackout.
+ */
+void MessageCache::insert(const Cache_Item &item) {
+	Index::iterator it;
+
+	if (insertSeries(item))
+		return;
+
+	if (item.msg.valid) {
+		it = sendable.insert(make_pair(Cache_Key(item.msg.priority, item.msg.time), item));
+	}
+	else {
+		if (blackouts.empty() || blackouts.back().resolved)
+			blackouts.push_back(Blackout());
+		it = blackouts.back().index.insert(make_pair(Cache_Key(item.msg.priority, item.msg.offset), item));
+	}
+	bytes += footprint(it->second);
+}
+
+/**
+ * Remove message with the highest priority and valid timestamp from the cache.
+ * Timestamp of a message from resolved blackout is computed now.
+ * @param item Removed message
+ * @return false if there is no message which can be sent
+ */
+bool MessageCache::pop(Cache_Item &item) {
+	set<MSG_PRIO> ready = readyPriorities();
+	if (ready.empty())
+		return false;
+
+	MSG_PRIO priority = *ready.rbegin();
+	Lane_Policy policy = LANE_OLDEST_FIRST;
+	if (!lanes.empty()) {
+		priority = selectLane(ready);
+		auto lane = lanes.find(priority);
+		if (lane != lanes.end())
+			policy = lane->second.policy;
+	}
+
+	Candidate candidate;
+	head(priority, policy, candidate);
+
+	if (candidate.index == NULL) {
+		ReadingSeries &readings = candidate.series->second;
+		size_t before = seriesFootprint(readings);
+		IOTMessage msg = (policy == LANE_NEWEST_FIRST) ? readings.popBack() : readings.popFront();
+
+		item = Cache_Item(msg.seq, msg);
+		updateSeries(candidate.series, before);
+		return true;
+	}
+
+	item = candidate.it->second;
+	if (candidate.index != &sendable) {
+		item.msg.time = candidate.time;
+		item.msg.offset = 0;
+		item.msg.valid = true;
+	}
+	bytes -= footprint(candidate.it->second);
+	candidate.index->erase(candidate.it);
+
+	forgetBlackouts();
+	return true;
+}
+
+/**
+ * Append sensor reading to the compressed series of its device. Readings which were
+ * already serialized (returned after a failed send) or came out of order are kept
+ * in the index.
+ * @return false if the message was not stored in a series
+ */
+bool MessageCache::insertSeries(const Cache_Item &item) {
+	const IOTMessage &msg = item.msg;
+
+	if (!compress || msg.priority > MSG_PRIO_SENSOR || !msg.wire.empty() || item.id != msg.seq || !ReadingSeries::eligible(msg))
+		return false;
+
+	auto key = make_pair(msg.priority, msg.device.euid);
+	auto it = series.find(key);
+	size_t before = 0;
+
+	if (it == series.end())
+		it = series.insert(make_pair(key, ReadingSeries(msg))).first;
+	else
+		before = seriesFootprint(it->second);
+
+	bool appended = it->second.append(msg);
+	updateSeries(it, before);
+	return appended;
+}
+
+size_t MessageCache::seriesFootprint(const ReadingSeries &readings) {
+	return INDEX_NODE_OVERHEAD + sizeof(Series_Map::value_type) + readings.footprint();
+}
+
+/**
+ * Account the change of memory occupied by the series, empty series is removed.
+ * @param before Footprint of the series before the change (0 for new series)
+ */
+void MessageCache::updateSeries(Series_Map::iterator it, size_t before) {
+	bytes -= before;
+	if (it->second.empty())
+		series.erase(it);
+	else
+		bytes += seriesFootprint(it->second);
+}
+
+/**
+ * Forget resolved blackouts without messages.
+ */
+void MessageCache::forgetBlackouts() {
+	for (auto blackout = blackouts.begin(); blackout != blackouts.end(); ) {
+		if (blackout->resolved && blackout->index.empty())
+			blackout = blackouts.erase(blackout);
+		else
+			++blackout;
+	}
+}
+
+/**
+ * Priorities of sendable messages in the cache.
+ */
+set<MSG_PRIO> MessageCache::readyPriorities() {
+	set<MSG_PRIO> ready;
+	auto collect = [&ready](const Index &index) {
+		for (auto it = index.begin(); it != index.end(); it = index.upper_bound(Cache_Key(it->first.priority, LLONG_MAX)))
+			ready.insert(it->first.priority);
+	};
+
+	collect(sendable);
+	for (const Blackout &blackout : blackouts) {
+		if (blackout.resolved)
+			collect(blackout.index);
+	}
+	for (auto &entry : series)
+		ready.insert(entry.first.first);
+	return ready;
+}
+
+/**
+ * Choose the lane to take the next message from. Priorities without a lane are
+ * served first, then a lane waiting longer than lane_aging, otherwise the lanes
+ * are served by smooth weighted round-robin.
+ * @param ready Priorities of sendable messages
+ */
+MSG_PRIO MessageCache::selectLane(const set<MSG_PRIO> &ready) {
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+	for (auto it = ready.rbegin(); it != ready.rend(); ++it) {
+		if (lanes.find(*it) == lanes.end())
+			return *it;
+	}
+
+	Lane *selected = NULL;
+	MSG_PRIO priority = *ready.rbegin();
+	long long int total = 0;
+
+	for (auto &entry : lanes) {
+		Lane &lane = entry.second;
+
+		if (ready.find(entry.first) == ready.end()) {
+			lane.waiting = now;
+			continue;
+		}
+
+		lane.credit += lane.weight;
+		total += lane.weight;
+		if (selected == NULL || lane.credit >= selected->credit) {
+			selected = &lane;
+			priority = entry.first;
+		}
+	}
+
+	// The lane waiting for the longest time above lane_aging wins regardless of its credit
+	Lane *aged = NULL;
+	for (auto &entry : lanes) {
+		if (lane_aging == 0 || ready.find(entry.first) == ready.end())
+			continue;
+		if (now - entry.second.waiting < chrono::seconds(lane_aging))
+			continue;
+		if (aged == NULL || entry.second.waiting < aged->waiting) {
+			aged = &entry.second;
+			priority = entry.first;
+		}
+	}
+	if (aged != NULL)
+		selected = aged;
+
+	selected->credit -= total;
+	selected->waiting = now;
+	return priority;
+}
+
+/**
+ * Find the oldest (newest) sendable message of the given priority.
+ * @param candidate Found message
+ * @return false if there is no such message
+ */
+bool MessageCache::head(MSG_PRIO priority, Lane_Policy policy, Candidate &candidate) {
+	bool found = false;
+	auto consider = [&](Index &index, long long int base) {
+		Index::iterator first = index.lower_bound(Cache_Key(priority, LLONG_MIN));
+		Index::iterator last = index.upper_bound(Cache_Key(priority, LLONG_MAX));
+		if (first == last)
+			return;
+
+		Index::iterator it = (policy == LANE_NEWEST_FIRST) ? prev(last) : first;
+		long long int time = base + it->first.time;
+		if (!found || (policy == LANE_NEWEST_FIRST ? time > candidate.time : time < candidate.time)) {
+			candidate = Candidate{&index, it, time, series.end()};
+			found = true;
+		}
+	};
+
+	consider(sendable, 0);
+	for (auto it = series.begin(); it != series.end(); ++it) {
+		if (it->first.first != priority)
+			continue;
+
+		long long int time = (policy == LANE_NEWEST_FIRST) ? it->second.lastTime() : it->second.firstTime();
+		if (!found || (policy == LANE_NEWEST_FIRST ? time > candidate.time : time < candidate.time)) {
+			candidate = Candidate{NULL, Index::iterator(), time, it};
+			found = true;
+		}
+	}
+	for (Blackout &blackout : blackouts) {
+		if (blackout.resolved)
+			consider(blackout.index, blackout.orig_ts);
+	}
+	return found;
+}
+
+/**
+ * Set the beginning of the current blackout, its messages become sendable.
+ * @param orig_ts Timestamp of the beginning of the blackout
+ */
+void MessageCache::resolveBlackout(long long int orig_ts) {
+	if (blackouts.empty() || blackouts.back().resolved)
+		return;
+
+	blackouts.back().orig_ts = orig_ts;
+	blackouts.back().resolved = true;
+}
+
+size_t MessageCache::sendableCount() const {
+	size_t count = sendable.size();
+
+	for (const Blackout &blackout : blackouts) {
+		if (blackout.resolved)
+			count += blackout.index.size();
+	}
+	for (auto &entry : series)
+		count += entry.second.size();
+	return count;
+}
+
+size_t MessageCache::invalidCount() const {
+	size_t count = 0;
+
+	for (const Blackout &blackout : blackouts) {
+		if (!blackout.resolved)
+			count += blackout.index.size();
+	}
+	return count;
+}
+
+/**
+ * Number of cached messages of every priority, including messages with invalid timestamp.
+ */
+map<MSG_PRIO, size_t> MessageCache::countByPriority() const {
+	map<MSG_PRIO, size_t> counts;
+
+	for (auto &item : sendable)
+		counts[item.first.priority]++;
+	for (auto &entry : series)
+		counts[entry.first.first] += entry.second.size();
+	for (const Blackout &blackout : blackouts) {
+		for (auto &item : blackout.index)
+			counts[item.first.priority]++;
+	}
+	return counts;
+}
+
+/**
+ * Timestamp of the oldest message with valid timestamp.
+ * @return 0 if there is no such message
+ */
+long long int MessageCache::oldestTime() const {
+	long long int oldest = 0;
+	auto older = [&oldest](long long int time) {
+		if (oldest == 0 || time < oldest)
+			oldest = time;
+	};
+
+	for (auto &item : sendable)
+		older(item.first.time);
+	for (auto &entry : series) {
+		if (!entry.second.empty())
+			older(entry.second.firstTime());
+	}
+	for (const Blackout &blackout : blackouts) {
+		if (!blackout.resolved)
+			continue;
+		for (auto &item : blackout.index)
+			older(blackout.orig_ts + item.first.time);
+	}
+	return oldest;
+}
+
+/**
+ * Remove messages until the cache fits into its memory budget. The oldest messages
+ * from history are removed first, then sensor readings are thinned out, so readings
+ * of each device are at least the thinning resolution apart. The resolution doubles
+ * whenever thinning by it is not enough and it is kept for next evictions, so the
+ * remaining readings cover the whole outage evenly. Actuator, parameter and
+ * registration messages are never removed.
+ * @return Removed messages
+ */
+vector<Cache_Item> MessageCache::evict() {
+	vector<Cache_Item> evicted;
+
+	if (budget == 0 || bytes <= budget) {
+		// The backlog was sent, new outage starts with the finest resolution
+		if (bytes <= budget / 2)
+			thin_resolution = 0;
+		return evicted;
+	}
+
+	evictHistory(sendable, evicted);
+	for (Blackout &blackout : blackouts)
+		evictHistory(blackout.index, evicted);
+	while (bytes > budget && evictSeriesHistory(evicted))
+		;
+
+	if (thin_resolution == 0)
+		thin_resolution = 1;
+
+	while (bytes > budget) {
+		bool removed = thinOut(sendable, evicted);
+		for (Blackout &blackout : blackouts)
+			removed |= thinOut(blackout.index, evicted);
+		removed |= thinOutSeries(evicted);
+		if (bytes <= budget || (!removed && thin_resolution >= CACHE_THIN_MAX_RESOLUTION))
+			break;
+		thin_resolution *= 2;
+	}
+	forgetBlackouts();
+	return evicted;
+}
+
+/**
+ * Remove values older than their TTL (see setTTL()). Messages stored during a blackout
+ * which was not resolved yet are kept, their age is not known.
+ * @param now Current timestamp
+ * @param updated Cached messages which lost some of their values
+ * @param removed Cached messages which lost all of their values and were removed from the cache
+ */
+void MessageCache::expire(long long int now, vector<Cache_Item> &updated, vector<Cache_Item> &removed) {
+	if (device_ttl.empty() && module_ttl.empty())
+		return;
+
+	expireIndex(sendable, 0, now, updated, removed);
+	for (Blackout &blackout : blackouts) {
+		if (blackout.resolved)
+			expireIndex(blackout.index, blackout.orig_ts, now, updated, removed);
+	}
+	forgetBlackouts();
+
+	for (auto it = series.begin(); it != series.end(); ) {
+		auto current = it++;
+		ReadingSeries &readings = current->second;
+		size_t before = seriesFootprint(readings);
+
+		for (size_t block = 0; block < readings.blockCount(); ) {
+			vector<IOTMessage> msgs = readings.decodeBlock(block);
+			vector<IOTMessage> kept;
+			bool changed = false;
+
+			for (IOTMessage &msg : msgs) {
+				if (!expireValues(msg, now)) {
+					kept.push_back(msg);
+					continue;
+				}
+				changed = true;
+				if (msg.device.values.empty()) {
+					removed.push_back(Cache_Item(msg.seq, msg));
+				}
+				else {
+					updated.push_back(Cache_Item(msg.seq, msg));
+					kept.push_back(msg);
+				}
+			}
+
+			if (changed)
+				readings.replaceBlock(block, kept);
+			if (!kept.empty())
+				block++;
+		}
+		updateSeries(current, before);
+	}
+}
+
+/**
+ * Remove values of the message older than their TTL.
+ * @return true if the message was changed, message without values should be removed
+ */
+bool MessageCache::expireValues(IOTMessage &msg, long long int now) const {
+	long long int age = now - msg.time;
+	vector<Value> &values = msg.device.values;
+	size_t count = values.size();
+
+	if (values.empty()) {
+		unsigned int seconds = ttl(msg.device.device_id, -1);
+		return seconds > 0 && age >= seconds;
+	}
+
+	for (auto value = values.begin(); value != values.end(); ) {
+		unsigned int seconds = ttl(msg.device.device_id, value->mid);
+		if (seconds > 0 && age >= seconds)
+			value = values.erase(value);
+		else
+			++value;
+	}
+	if (values.size() == count)
+		return false;
+
+	msg.device.pairs = values.size();
+	msg.wire.clear();
+	return true;
+}
+
+/**
+ * TTL of the module of device type, TTL of the device type is used when the module
+ * has none.
+ * @return Seconds, 0 if the values never expire
+ */
+unsigned int MessageCache::ttl(long int device_id, int module_id) const {
+	auto module = module_ttl.find(make_pair(device_id, module_id));
+	if (module != module_ttl.end())
+		return module->second;
+
+	auto device = device_ttl.find(device_id);
+	return (device != device_ttl.end()) ? device->second : 0;
+}
+
+void MessageCache::expireIndex(Index &index, long long int base, long long int now, vector<Cache_Item> &updated, vector<Cache_Item> &removed) {
+	for (Index::iterator it = index.begin(); it != index.end(); ) {
+		IOTMessage &msg = it->second.msg;
+		size_t size = footprint(it->second);
+
+		// Timestamp of blackout message is its offset
+		long long int time = msg.time;
+		msg.time = base + it->first.time;
+		bool changed = expireValues(msg, now);
+		msg.time = time;
+
+		if (!changed) {
+			++it;
+			continue;
+		}
+
+		if (msg.device.values.empty()) {
+			bytes -= size;
+			removed.push_back(it->second);
+			it = index.erase(it);
+		}
+		else {
+			bytes = bytes - size + footprint(it->second);
+			updated.push_back(it->second);
+			++it;
+		}
+	}
+}
+
+void MessageCache::clear() {
+	sendable.clear();
+	blackouts.clear();
+	series.clear();
+	slots.clear();
+	bytes = 0;
+}
+
+/**
+ * Enable coalescing of cached values by (euid, module_id).
+ * @param window Only the newest value of actuator or state module within this window (seconds) is kept
+ * @param resolution Values of sensor module are kept at most once per this interval (seconds)
+ */
+void MessageCache::setCoalescing(unsigned int window, unsigned int resolution) {
+	coalesce_window = window;
+	coalesce_resolution = resolution;
+	if (window > 0 || resolution > 0)
+		tt = fillDeviceTable();
+}
+
+/**
+ * Let messages of the given priority share the link with other lanes by weight
+ * instead of waiting for all messages of higher priority.
+ * @param weight Share of the lane relative to the other lanes
+ * @param policy Order of messages taken from the lane
+ */
+void MessageCache::setLane(MSG_PRIO priority, unsigned int weight, Lane_Policy policy) {
+	lanes[priority] = Lane{weight, policy, 0, chrono::steady_clock::now()};
+}
+
+/**
+ * Coalesce values of the new message with values of the same modules in the cache.
+ * The new value of actuator or state module replaces the cached one from the same window,
+ * the new value of sensor module is dropped when the cached one is not older than resolution.
+ * Cached message kept in a compressed series is not changed, so only values of sensor
+ * modules are coalesced with it. Must be called before insertion of the new message.
+ * @param item New message, values dropped by coalescing are removed from it
+ * @param updated Cached messages which lost some of their values
+ * @param removed Cached messages which lost all of their values and were removed from the cache
+ * @return false if the new message has no values left and it should not be cached
+ */
+bool MessageCache::coalesce(Cache_Item &item, vector<Cache_Item> &updated, vector<Cache_Item> &removed) {
+	IOTMessage &msg = item.msg;
+
+	if ((coalesce_window == 0 && coalesce_resolution == 0) || !msg.valid || msg.device.values.empty())
+		return true;
+
+	Cache_Key key(msg.priority, msg.time);
+	map<uint64_t, Index::iterator> changed;
+	vector<Value> values;
+
+	for (const Value &value : msg.device.values) {
+		Module_Key module(msg.device.euid, value.mid);
+		auto slot = slots.find(module);
+		Index::iterator cached = sendable.end();
+		bool compressed = false;
+
+		if (slot != slots.end()) {
+			cached = findSlot(slot->second);
+			if (cached == sendable.end())
+				compressed = seriesContains(msg.device.euid, slot->second);
+		}
+		if ((cached == sendable.end() && !compressed) || msg.time < slot->second.key.time) {
+			slots[module] = Coalesce_Slot{key, item.id, msg.time};
+			values.push_back(value);
+			continue;
+		}
+
+		long long int age = msg.time - slot->second.anchor;
+		if (isStateModule(msg.device.device_id, value.mid)) {
+			if (age < coalesce_window && !compressed) {
+				vector<Value> &old_values = cached->second.msg.device.values;
+				for (auto it = old_values.begin(); it != old_values.end(); ) {
+					if (it->mid == value.mid)
+						it = old_values.erase(it);
+					else
+						++it;
+				}
+				changed[cached->second.id] = cached;
+				slots[module] = Coalesce_Slot{key, item.id, slot->second.anchor};
+			}
+			else {
+				slots[module] = Coalesce_Slot{key, item.id, msg.time};
+			}
+			values.push_back(value);
+		}
+		else if (age >= coalesce_resolution) {
+			slots[module] = Coalesce_Slot{key, item.id, msg.time};
+			values.push_back(value);
+		}
+	}
+
+	for (auto &entry : changed) {
+		Index::iterator it = entry.second;
+		IOTMessage &old_msg = it->second.msg;
+
+		old_msg.device.pairs = old_msg.device.values.size();
+		old_msg.wire.clear();
+		if (old_msg.device.values.empty()) {
+			bytes -= footprint(it->second);
+			removed.push_back(it->second);
+			sendable.erase(it);
+		}
+		else {
+			updated.push_back(it->second);
+		}
+	}
+
+	if (values.size() != msg.device.values.size())
+		msg.wire.clear();
+	msg.device.values = values;
+	msg.device.pairs = values.size();
+	return !values.empty();
+}
+
+/**
+ * Device modules with enumerated values and actuators hold a state, only their
+ * latest value is important.
+ */
+bool MessageCache::isStateModule(long int device_id, int module_id) const {
+	auto device = tt.find(device_id);
+	if (device == tt.end())
+		return false;
+
+	auto module = device->second.modules.find(module_id);
+	if (module == device->second.modules.end())
+		return false;
+
+	return module->second.module_is_actuator || !module->second.module_values.empty();
+}
+
+/**
+ * Find the cached message referenced by the slot. It is not found when the message
+ * was taken from the cache in the meantime.
+ */
+MessageCache::Index::iterator MessageCache::findSlot(const Coalesce_Slot &slot) {
+	auto range = sendable.equal_range(slot.key);
+
+	for (Index::iterator it = range.first; it != range.second; ++it) {
+		if (it->second.id == slot.id)
+			return it;
+	}
+	return sendable.end();
+}
+
+/**
+ * Check whether the message referenced by the slot is kept in the compressed series
+ * of the device. Readings are ordered by their timestamps, so blocks are decoded
+ * from the end of the series only up to the timestamp of the message.
+ */
+bool MessageCache::seriesContains(euid_t euid, const Coalesce_Slot &slot) const {
+	auto it = series.find(make_pair(slot.key.priority, euid));
+	if (it == series.end())
+		return false;
+
+	const ReadingSeries &readings = it->second;
+	if (slot.key.time < readings.firstTime() || slot.key.time > readings.lastTime())
+		return false;
+
+	for (size_t i = readings.blockCount(); i > 0; i--) {
+		vector<IOTMessage> msgs = readings.decodeBlock(i - 1);
+		for (const IOTMessage &reading : msgs) {
+			if (reading.seq == slot.id)
+				return true;
+		}
+		if (!msgs.empty() && msgs.front().time <= slot.key.time)
+			break;
+	}
+	return false;
+}
+
+/**
+ * Estimate memory occupied by the message in the cache.
+ */
+size_t MessageCache::footprint(const Cache_Item &item) {
+	const IOTMessage &msg = item.msg;
+	size_t size = INDEX_NODE_OVERHEAD + sizeof(Index::value_type);
+
+	size += stringFootprint(msg.protocol_version);
+	size += stringFootprint(msg.state);
+	size += stringFootprint(msg.adapter_id);
+	size += stringFootprint(msg.fw_version);
+	size += stringFootprint(msg.device.name);
+	size += stringFootprint(msg.wire);
+	size += msg.device.values.capacity() * sizeof(Value);
+	size += msg.params.value.capacity() * sizeof(pair<string, string>);
+	for (auto &value : msg.params.value)
+		size += stringFootprint(value.first) + stringFootprint(value.second);
+
+	return size;
+}
+
+void MessageCache::erase(Index &index, Index::iterator it, vector<Cache_Item> &evicted) {
+	bytes -= footprint(it->second);
+	evicted.push_back(it->second);
+	index.erase(it);
+}
+
+/**
+ * Remove the oldest messages from history until the budget is met.
+ */
+void MessageCache::evictHistory(Index &index, vector<Cache_Item> &evicted) {
+	Index::iterator it = index.lower_bound(Cache_Key(MSG_PRIO_HISTORY, LLONG_MIN));
+
+	while (bytes > budget && it != index.end())
+		erase(index, it++, evicted);
+}
+
+/**
+ * Remove the oldest reading from the compressed history.
+ * @return false if there is no history in series
+ */
+bool MessageCache::evictSeriesHistory(vector<Cache_Item> &evicted) {
+	auto oldest = series.end();
+
+	for (auto it = series.begin(); it != series.end(); ++it) {
+		if (it->first.first == MSG_PRIO_HISTORY && (oldest == series.end() || it->second.firstTime() < oldest->second.firstTime()))
+			oldest = it;
+	}
+	if (oldest == series.end())
+		return false;
+
+	size_t before = seriesFootprint(oldest->second);
+	IOTMessage msg = oldest->second.popFront();
+	evicted.push_back(Cache_Item(msg.seq, msg));
+	updateSeries(oldest, before);
+	return true;
+}
+
+/**
+ * Remove compressed sensor readings of each device which are closer than the thinning
+ * resolution to the previous kept reading, starting with the oldest blocks, until
+ * the budget is met.
+ * @return false if no reading could be removed
+ */
+bool MessageCache::thinOutSeries(vector<Cache_Item> &evicted) {
+	bool removed = false;
+
+	for (auto it = series.begin(); it != series.end() && bytes > budget; ) {
+		auto current = it++;
+		ReadingSeries &readings = current->second;
+
+		if (current->first.first != MSG_PRIO_SENSOR)
+			continue;
+
+		size_t before = seriesFootprint(readings);
+		long long int last_kept = LLONG_MIN;
+
+		for (size_t block = 0; block < readings.blockCount() && bytes > budget; block++) {
+			vector<IOTMessage> msgs = readings.decodeBlock(block);
+			vector<IOTMessage> kept;
+
+			for (const IOTMessage &msg : msgs) {
+				if (last_kept == LLONG_MIN || msg.time - last_kept >= thin_resolution) {
+					last_kept = msg.time;
+					kept.push_back(msg);
+					continue;
+				}
+				evicted.push_back(Cache_Item(msg.seq, msg));
+				removed = true;
+			}
+			if (kept.size() == msgs.size())
+				continue;
+
+			size_t size = seriesFootprint(readings);
+			readings.replaceBlock(block, kept);
+			bytes = bytes - size + seriesFootprint(readings);
+		}
+		bytes = bytes - seriesFootprint(readings) + before;
+		updateSeries(current, before);
+	}
+	return removed;
+}
+
+/**
+ * Remove sensor readings of each device which are closer than the thinning resolution
+ * to the previous kept reading, starting with the oldest ones, until the budget is met.
+ * @return false if no reading could be removed
+ */
+bool MessageCache::thinOut(Index &index, vector<Cache_Item> &evicted) {
+	Index::iterator it = index.lower_bound(Cache_Key(MSG_PRIO_SENSOR, LLONG_MIN));
+	Index::iterator end = index.lower_bound(Cache_Key(MSG_PRIO_HISTORY, LLONG_MIN));
+	map<euid_t, long long int> last_kept;   // time of the last kept reading of device
+	bool removed = false;
+
+	while (bytes > budget && it != end) {
+		auto device = last_kept.insert(make_pair(it->second.msg.device.euid, it->first.time));
+
+		if (device.second || it->first.time - device.first->second >= thin_resolution) {
+			device.first->second = it->first.time;
+			++it;
+			continue;
+		}
+		erase(index, it++, evicted);
+		removed = true;
+	}
+	return removed;
+}
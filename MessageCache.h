@@ -0,0 +1,226 @@
+/**
+ * @file MessageCache.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Cache for messages which could not be sent to the server
+ */
+
+#ifndef MESSAGECACHE_H
+#define	MESSAGECACHE_H
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "device_table.h"
+#include "ReadingSeries.h"
+#include "utils.h"
+
+#define CACHE_THIN_MAX_RESOLUTION 31536000 // seconds (one year)
+
+struct Cache_Key {
+
+	Cache_Key() : time(0), priority(MSG_PRIO_HISTORY) {}
+	Cache_Key(MSG_PRIO p, long long int t) : time(t), priority (p) {}
+
+	bool operator<(const Cache_Key& key) const {
+		// The most important is the highest priority
+		if (priority > key.priority)
+			return true;
+		else if (priority < key.priority)
+			return false;
+		else {
+			if (time < key.time)
+				return true;
+			else
+				return false;
+		}
+	}
+
+	bool operator>(const Cache_Key& key) const {
+		if (priority < key.priority)
+			return true;
+		else if (priority > key.priority)
+			return false;
+		else {
+			if (time > key.time)
+				return true;
+			else
+				return false;
+		}
+	}
+
+	long long int time;
+	MSG_PRIO priority;
+};
+
+/**
+ * Cached message together with its identifier in the persistent journal.
+ */
+struct Cache_Item {
+	Cache_Item() : id(0) {}
+	Cache_Item(uint64_t _id, const IOTMessage &_msg) : id(_id), msg(_msg) {}
+
+	uint64_t id;
+	IOTMessage msg;
+};
+
+/**
+ * Order of messages taken from one lane of the cache.
+ */
+enum Lane_Policy {
+	LANE_OLDEST_FIRST,
+	LANE_NEWEST_FIRST
+};
+
+/**
+ * Cache of messages waiting for sending to the server. Messages with valid timestamp
+ * and messages stored during a blackout of time service are kept in separate indexes
+ * ordered by priority. Messages of every blackout are kept in its own index with
+ * timestamps relative to the beginning of the blackout. When the time is valid again,
+ * only the beginning of the blackout is set and timestamps of its messages are computed
+ * when they are taken from the cache. Memory occupied by the cached messages can be limited by a budget,
+ * see evict(). Messages are taken by their priority unless send lanes are configured,
+ * see setLane(). Sensor readings can be kept compressed in series per device, see setCompression(). The class is not thread safe, the caller is responsible for locking.
+ */
+class MessageCache {
+public:
+	typedef std::multimap<Cache_Key, Cache_Item> Index;
+
+	MessageCache() : bytes(0), budget(0), coalesce_window(0), coalesce_resolution(0), lane_aging(0), compress(false), thin_resolution(0) {}
+
+	void insert(const Cache_Item &item);
+	bool coalesce(Cache_Item &item, std::vector<Cache_Item> &updated, std::vector<Cache_Item> &removed);
+	bool pop(Cache_Item &item);
+	void resolveBlackout(long long int orig_ts);
+	std::vector<Cache_Item> evict();
+	void expire(long long int now, std::vector<Cache_Item> &updated, std::vector<Cache_Item> &removed);
+	void clear();
+
+	void setBudget(std::size_t _budget) { budget = _budget; }
+	std::size_t getBudget() const { return budget; }
+	void setCoalescing(unsigned int window, unsigned int resolution);
+	void setLane(MSG_PRIO priority, unsigned int weight, Lane_Policy policy);
+	void setLaneAging(unsigned int seconds) { lane_aging = seconds; }
+	void setCompression(bool enabled) { compress = enabled; }
+	void setTTL(long int device_id, unsigned int seconds) { device_ttl[device_id] = seconds; }
+	void setTTL(long int device_id, int module_id, unsigned int seconds) { module_ttl[std::make_pair(device_id, module_id)] = seconds; }
+	std::size_t memoryUsage() const { return bytes; }
+
+	bool empty() const { return size() == 0; }
+	std::size_t size() const { return sendableCount() + invalidCount(); }
+	std::size_t sendableCount() const;
+	std::size_t invalidCount() const;
+	std::map<MSG_PRIO, std::size_t> countByPriority() const;
+	long long int oldestTime() const;
+
+	/**
+	 * Call the given function for every cached message, messages with valid timestamp first.
+	 */
+	template <typename Function>
+	void forEach(Function f) const {
+		for (auto &item : sendable)
+			f(item.second);
+		for (auto &entry : series) {
+			for (const IOTMessage &msg : entry.second.decode())
+				f(Cache_Item(msg.seq, msg));
+		}
+		for (auto &blackout : blackouts) {
+			for (auto &item : blackout.index)
+				f(item.second);
+		}
+	}
+
+private:
+	/**
+	 * Messages stored during one blackout of time service.
+	 */
+	struct Blackout {
+		Blackout() : orig_ts(0), resolved(false) {}
+
+		long long int orig_ts;  // timestamp of the beginning of blackout, valid when resolved
+		bool resolved;
+		Index index;            // key is (priority, offset)
+	};
+
+	/**
+	 * The latest cached value of one module of a device.
+	 */
+	struct Coalesce_Slot {
+		Cache_Key key;          // key of the message in the sendable index
+		uint64_t id;            // identifier of the message
+		long long int anchor;   // start of the window (resolution interval) of the value
+	};
+
+	typedef std::pair<euid_t, int> Module_Key;
+	typedef std::map<std::pair<MSG_PRIO, euid_t>, ReadingSeries> Series_Map;
+
+	/**
+	 * Messages of one priority sharing the link with other lanes by their weights.
+	 */
+	struct Lane {
+		unsigned int weight;
+		Lane_Policy policy;
+		long long int credit;   // smooth weighted round-robin counter
+		std::chrono::steady_clock::time_point waiting;   // lane has messages since this time without being served
+	};
+
+	/**
+	 * The first message of a lane in one of the indexes.
+	 */
+	struct Candidate {
+		Index *index;           // NULL for message from series
+		Index::iterator it;
+		long long int time;     // timestamp of the message (rebased for blackout messages)
+		Series_Map::iterator series;
+	};
+
+	std::set<MSG_PRIO> readyPriorities();
+	MSG_PRIO selectLane(const std::set<MSG_PRIO> &ready);
+	bool head(MSG_PRIO priority, Lane_Policy policy, Candidate &candidate);
+	void forgetBlackouts();
+
+	bool insertSeries(const Cache_Item &item);
+	static std::size_t seriesFootprint(const ReadingSeries &readings);
+	void updateSeries(Series_Map::iterator it, std::size_t before);
+	bool evictSeriesHistory(std::vector<Cache_Item> &evicted);
+	bool thinOutSeries(std::vector<Cache_Item> &evicted);
+	bool expireValues(IOTMessage &msg, long long int now) const;
+
+	unsigned int ttl(long int device_id, int module_id) const;
+	void expireIndex(Index &index, long long int base, long long int now, std::vector<Cache_Item> &updated, std::vector<Cache_Item> &removed);
+
+	bool isStateModule(long int device_id, int module_id) const;
+	Index::iterator findSlot(const Coalesce_Slot &slot);
+	bool seriesContains(euid_t euid, const Coalesce_Slot &slot) const;
+
+	static std::size_t footprint(const Cache_Item &item);
+	void erase(Index &index, Index::iterator it, std::vector<Cache_Item> &evicted);
+	void evictHistory(Index &index, std::vector<Cache_Item> &evicted);
+	bool thinOut(Index &index, std::vector<Cache_Item> &evicted);
+
+	Index sendable;         // messages with valid timestamp, key is (priority, time)
+	std::list<Blackout> blackouts;   // messages from blackouts of time service, the last one can be unresolved
+	std::size_t bytes;      // memory occupied by cached messages
+	std::size_t budget;     // maximal memory for cached messages in bytes (0 = unlimited)
+
+	unsigned int coalesce_window;        // seconds in which only the newest value of actuator/state module is kept (0 = disabled)
+	unsigned int coalesce_resolution;    // seconds between kept values of sensor module (0 = disabled)
+	TT_Table tt;
+	std::map<Module_Key, Coalesce_Slot> slots;
+
+	std::map<MSG_PRIO, Lane> lanes;      // weighted lanes, other priorities are served first (empty = strict priority)
+	unsigned int lane_aging;             // seconds after which a waiting lane is served regardless of its weight (0 = disabled)
+
+	bool compress;                       // sensor readings are kept compressed in series
+	Series_Map series;                   // compressed readings with valid timestamp, key is (priority, euid)
+	long long int thin_resolution;       // seconds between sensor readings kept by eviction (0 = not thinned yet)
+
+	std::map<long int, unsigned int> device_ttl;                  // seconds after which values of device type expire
+	std::map<std::pair<long int, int>, unsigned int> module_ttl;  // overrides device_ttl for one module of device type
+};
+
+#endif	/* MESSAGECACHE_H */
@@ -280,9 +280,9 @@ void PanInterface::msgFromPAN(uint8_t msg_type, std::vector<uint8_t> data) {
 
 			// TODO? Send just message header if there wasn't any sensor?
 			if (msg.device.pairs > 0) {
-				agg->sendData(msg);
+				agg->sendDataAsync(msg);
 			}
-			log.information("Message sent to server.");
+			log.information("Message queued for server.");
 		}
 		catch (std::out_of_range) {
 			log.error("Data are in incorrect format (out_of_range exception)");
@@ -67,7 +67,7 @@ bool Parameters::cmdFromServer(Command cmd)
 		msg.params = filled_params;	// add parameters block (struct)
 		msg.state = "parameters";	// for answer is this state
 		msg.time = time(NULL);		// set actual time
-		agg.sendData(msg);			// send (response) to server
+		agg.sendDataAsync(msg);			// send (response) to server
 		return true;
 	}
 	else if (cmd.state == "parameters") { // response from the server or other information
@@ -111,7 +111,8 @@ CmdParam Parameters::askServer(CmdParam cmd_request)
 	msg.state = "getparameters";	// for request is this state
 	msg.time = time(NULL);			// set actual time
 	log.information("Ask the Server | state = getparameters | param_id = " + toStringFromInt(cmd_request.param_id));
-	pair<bool, Command> response = agg.sendData(msg);	// send to server
+	// Sent synchronously, the answer is needed right away and the caller may be the Sender thread
+	pair<bool, Command> response = agg.sendData(msg);	// send to server and wait for the answer
 	if (response.first && response.second.state == "parameters"){
 		log.information("Ask the Server | return OK");
 		justPrintToLog(response.second.params);
@@ -48,7 +48,7 @@ void PressureSensor::threadFunction(){
 		pair<bool, Command> response;
 		if (createMsg()) {
 			response = agg->sendData(msg);
-			if (response.first) {
+			if (response.first && !response.second.state.empty()) {
 				parseCmdFromServer(response.second);
 			}
 		}
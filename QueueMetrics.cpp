@@ -0,0 +1,177 @@
+/**
+ * @file QueueMetrics.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Counters and gauges of the Aggregator's upstream queue
+ */
+
+#include <fstream>
+#include <sstream>
+
+#include <Poco/File.h>
+
+#include "MosqClient.h"
+#include "QueueMetrics.h"
+
+using namespace std;
+using Poco::File;
+
+// Upper bounds (milliseconds) of latency buckets, the last bucket is unbounded
+const unsigned int QueueMetrics::latency_bounds[METRICS_LATENCY_BUCKETS - 1] = {10, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+
+Metrics_Snapshot::Metrics_Snapshot() :
+	time(0),
+	oldest_age(-1),
+	memory(0),
+	enqueued(0),
+	dequeued(0),
+	enqueue_rate(0),
+	dequeue_rate(0),
+	send_success(0),
+	send_failure(0),
+	latency_sum(0),
+	journal_bytes(0)
+{
+	for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+		latency[i] = 0;
+}
+
+/**
+ * Serialize the snapshot as one JSON object.
+ */
+string Metrics_Snapshot::toJSON() const {
+	static const map<MSG_PRIO, string> names = {
+		{MSG_PRIO_HISTORY, "history"},
+		{MSG_PRIO_SENSOR, "sensor"},
+		{MSG_PRIO_PARAM, "param"},
+		{MSG_PRIO_ACTUATOR, "actuator"},
+		{MSG_PRIO_REG, "registration"},
+	};
+	ostringstream out;
+
+	out << "{\"time\":" << time << ",\"depth\":{";
+	bool first = true;
+	for (auto &name : names) {
+		auto it = depth.find(name.first);
+		out << (first ? "" : ",") << "\"" << name.second << "\":" << (it == depth.end() ? 0 : it->second);
+		first = false;
+	}
+	out << "},\"oldest_age\":" << oldest_age
+		<< ",\"memory\":" << memory
+		<< ",\"enqueued\":" << enqueued
+		<< ",\"dequeued\":" << dequeued
+		<< ",\"enqueue_rate\":" << enqueue_rate
+		<< ",\"dequeue_rate\":" << dequeue_rate
+		<< ",\"send_success\":" << send_success
+		<< ",\"send_failure\":" << send_failure
+		<< ",\"latency\":{";
+	for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+		string bound = (i < METRICS_LATENCY_BUCKETS - 1) ? to_string(QueueMetrics::latency_bounds[i]) : "inf";
+		out << (i > 0 ? "," : "") << "\"" << bound << "\":" << latency[i];
+	}
+	out << "},\"latency_sum\":" << latency_sum
+		<< ",\"journal_bytes\":" << journal_bytes << "}";
+	return out.str();
+}
+
+QueueMetrics::QueueMetrics() :
+	enqueue_count(0),
+	dequeue_count(0),
+	success_count(0),
+	failure_count(0),
+	latency_sum(0),
+	last_snapshot(std::chrono::steady_clock::now()),
+	last_enqueued(0),
+	last_dequeued(0)
+{
+	for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+		latency_buckets[i] = 0;
+}
+
+/**
+ * Count messages of one request to the server.
+ * @param success Messages acknowledged by the server
+ * @param failure Messages which were not delivered or acknowledged
+ */
+void QueueMetrics::sent(unsigned int success, unsigned int failure) {
+	if (success > 0)
+		success_count.fetch_add(success, std::memory_order_relaxed);
+	if (failure > 0)
+		failure_count.fetch_add(failure, std::memory_order_relaxed);
+}
+
+/**
+ * Add round-trip time of one request to the server to the histogram.
+ */
+void QueueMetrics::latency(std::chrono::steady_clock::duration duration) {
+	uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+	unsigned int bucket = 0;
+
+	while (bucket < METRICS_LATENCY_BUCKETS - 1 && ms > latency_bounds[bucket])
+		bucket++;
+
+	latency_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	latency_sum.fetch_add(ms, std::memory_order_relaxed);
+}
+
+/**
+ * Fill counters and rates of the snapshot. Rates are computed since the previous
+ * call, so only one thread may take snapshots.
+ */
+void QueueMetrics::snapshot(Metrics_Snapshot &snapshot) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - last_snapshot).count();
+
+	snapshot.enqueued = enqueue_count.load(std::memory_order_relaxed);
+	snapshot.dequeued = dequeue_count.load(std::memory_order_relaxed);
+	snapshot.send_success = success_count.load(std::memory_order_relaxed);
+	snapshot.send_failure = failure_count.load(std::memory_order_relaxed);
+	for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+		snapshot.latency[i] = latency_buckets[i].load(std::memory_order_relaxed);
+	snapshot.latency_sum = latency_sum.load(std::memory_order_relaxed);
+
+	if (elapsed > 0) {
+		snapshot.enqueue_rate = (snapshot.enqueued - last_enqueued) / elapsed;
+		snapshot.dequeue_rate = (snapshot.dequeued - last_dequeued) / elapsed;
+	}
+
+	last_snapshot = now;
+	last_enqueued = snapshot.enqueued;
+	last_dequeued = snapshot.dequeued;
+}
+
+MQTTMetricsReporter::MQTTMetricsReporter(shared_ptr<MosqClient> _mq, const string &_topic) :
+	mq(_mq),
+	topic(_topic)
+{
+}
+
+void MQTTMetricsReporter::report(const Metrics_Snapshot &snapshot) {
+	if (mq && mq->connected)
+		mq->send_message("[AdaApp]Metrics " + snapshot.toJSON(), topic);
+}
+
+FileMetricsReporter::FileMetricsReporter(const string &_path) :
+	path(_path),
+	log(Poco::Logger::get("Adaapp-AGG"))
+{
+}
+
+void FileMetricsReporter::report(const Metrics_Snapshot &snapshot) {
+	string tmp_path = path + ".tmp";
+	ofstream out(tmp_path.c_str(), ios::out | ios::trunc);
+
+	out << snapshot.toJSON() << endl;
+	out.close();
+	if (out.fail()) {
+		log.warning("Cannot write metrics to \"" + tmp_path + "\"");
+		return;
+	}
+
+	try {
+		File(tmp_path).renameTo(path);
+	}
+	catch (Poco::Exception& ex) {
+		log.warning("Cannot replace metrics file: " + ex.displayText());
+	}
+}
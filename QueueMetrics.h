@@ -0,0 +1,116 @@
+/**
+ * @file QueueMetrics.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Counters and gauges of the Aggregator's upstream queue
+ */
+
+#ifndef QUEUEMETRICS_H
+#define	QUEUEMETRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Poco/Logger.h>
+
+#include "utils.h"
+
+class MosqClient;
+
+#define METRICS_LATENCY_BUCKETS 10
+
+/**
+ * Values of queue metrics at one moment, see QueueMetrics::snapshot().
+ */
+struct Metrics_Snapshot {
+	Metrics_Snapshot();
+
+	long long int time;                        // timestamp of the snapshot
+	std::map<MSG_PRIO, std::size_t> depth;     // cached messages of every priority
+	long long int oldest_age;                  // seconds since the oldest cached message (-1 = none)
+	std::size_t memory;                        // memory occupied by cached messages (bytes)
+	uint64_t enqueued;                         // messages stored to the cache
+	uint64_t dequeued;                         // messages taken from the cache for sending
+	double enqueue_rate;                       // messages per second since the previous snapshot
+	double dequeue_rate;
+	uint64_t send_success;                     // messages acknowledged by the server
+	uint64_t send_failure;                     // messages not delivered or not acknowledged
+	uint64_t latency[METRICS_LATENCY_BUCKETS]; // requests to the server by their round-trip time
+	uint64_t latency_sum;                      // sum of round-trip times (milliseconds)
+	uint64_t journal_bytes;                    // bytes written to the cache journal
+
+	std::string toJSON() const;
+};
+
+/**
+ * Counters of the upstream queue updated by threads of the Aggregator. Counters
+ * are atomic, so sending threads never wait for a lock to update them. Gauges of
+ * the cache (depth, age of the oldest message) are sampled by the caller of snapshot().
+ */
+class QueueMetrics {
+public:
+	QueueMetrics();
+
+	void enqueued(unsigned int count = 1) { enqueue_count.fetch_add(count, std::memory_order_relaxed); }
+	void dequeued(unsigned int count = 1) { dequeue_count.fetch_add(count, std::memory_order_relaxed); }
+	void sent(unsigned int success, unsigned int failure);
+	void latency(std::chrono::steady_clock::duration duration);
+
+	void snapshot(Metrics_Snapshot &snapshot);
+
+	static const unsigned int latency_bounds[METRICS_LATENCY_BUCKETS - 1];
+
+private:
+	std::atomic<uint64_t> enqueue_count;
+	std::atomic<uint64_t> dequeue_count;
+	std::atomic<uint64_t> success_count;
+	std::atomic<uint64_t> failure_count;
+	std::atomic<uint64_t> latency_buckets[METRICS_LATENCY_BUCKETS];
+	std::atomic<uint64_t> latency_sum;
+
+	// Previous snapshot for computing of rates, snapshot() is called from one thread
+	std::chrono::steady_clock::time_point last_snapshot;
+	uint64_t last_enqueued;
+	uint64_t last_dequeued;
+};
+
+/**
+ * Destination of queue metrics.
+ */
+class MetricsReporter {
+public:
+	virtual ~MetricsReporter() {}
+	virtual void report(const Metrics_Snapshot &snapshot) = 0;
+};
+
+/**
+ * Publishes metrics to the MQTT topic BeeeOn/service.
+ */
+class MQTTMetricsReporter : public MetricsReporter {
+public:
+	MQTTMetricsReporter(std::shared_ptr<MosqClient> _mq, const std::string &_topic = "BeeeOn/service");
+	void report(const Metrics_Snapshot &snapshot) override;
+
+private:
+	std::shared_ptr<MosqClient> mq;
+	std::string topic;
+};
+
+/**
+ * Keeps the latest metrics in a local file, the file is replaced atomically.
+ */
+class FileMetricsReporter : public MetricsReporter {
+public:
+	FileMetricsReporter(const std::string &_path);
+	void report(const Metrics_Snapshot &snapshot) override;
+
+private:
+	std::string path;
+	Poco::Logger& log;
+};
+
+#endif	/* QUEUEMETRICS_H */
@@ -0,0 +1,374 @@
+/**
+ * @file ReadingSeries.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Compressed readings of one device in the message cache
+ */
+
+#include <cstring>
+
+#include "ReadingSeries.h"
+
+using namespace std;
+
+static void putBits(vector<uint8_t> &data, size_t &bits, uint64_t value, unsigned int n) {
+	for (unsigned int i = n; i > 0; i--) {
+		if (bits % 8 == 0)
+			data.push_back(0);
+		if ((value >> (i - 1)) & 1)
+			data.back() |= 0x80 >> (bits % 8);
+		bits++;
+	}
+}
+
+static uint64_t getBits(const vector<uint8_t> &data, size_t &pos, unsigned int n) {
+	uint64_t value = 0;
+
+	for (unsigned int i = 0; i < n; i++) {
+		value = (value << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+		pos++;
+	}
+	return value;
+}
+
+static uint32_t floatBits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float bitsFloat(uint32_t bits) {
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+ReadingSeries::ReadingSeries(const IOTMessage &msg) :
+	header(msg),
+	count(0)
+{
+	header.time = 0;
+	header.seq = 0;
+	header.wire.clear();
+	header.device.values.clear();
+	header.device.pairs = 0;
+}
+
+/**
+ * Only data messages with valid time and without parameters are stored in series.
+ */
+bool ReadingSeries::eligible(const IOTMessage &msg) {
+	const CmdParam &params = msg.params;
+
+	return msg.valid && msg.offset == 0 && !msg.debug && msg.seq != 0
+		&& !msg.device.values.empty() && msg.device.values.size() <= 255
+		&& params.param_id == 0 && params.module_id == -1 && params.euid == 0 && params.value.empty();
+}
+
+bool ReadingSeries::matches(const IOTMessage &msg) const {
+	return msg.priority == header.priority
+		&& msg.device.euid == header.device.euid
+		&& msg.device.device_id == header.device.device_id
+		&& msg.device.version == header.device.version
+		&& msg.device.name == header.device.name
+		&& msg.state == header.state
+		&& msg.adapter_id == header.adapter_id
+		&& msg.fw_version == header.fw_version
+		&& msg.protocol_version == header.protocol_version
+		&& msg.tt_version == header.tt_version;
+}
+
+/**
+ * Append reading to the series.
+ * @return false if the message has different header or it is older than the last reading
+ */
+bool ReadingSeries::append(const IOTMessage &msg) {
+	if (!eligible(msg) || !matches(msg) || (count > 0 && msg.time < lastTime()))
+		return false;
+
+	if (blocks.empty() || blocks.back().count >= SERIES_BLOCK_SIZE) {
+		if (!blocks.empty())
+			blocks.back().data.shrink_to_fit();
+		blocks.push_back(Block());
+		tail = State();
+	}
+	encode(blocks.back(), tail, msg);
+	count++;
+	return true;
+}
+
+IOTMessage ReadingSeries::popFront() {
+	vector<IOTMessage> msgs = decodeBlock(0);
+	IOTMessage msg = msgs.front();
+
+	msgs.erase(msgs.begin());
+	replaceBlock(0, msgs);
+	return msg;
+}
+
+IOTMessage ReadingSeries::popBack() {
+	vector<IOTMessage> msgs = decodeBlock(blocks.size() - 1);
+	IOTMessage msg = msgs.back();
+
+	msgs.pop_back();
+	replaceBlock(blocks.size() - 1, msgs);
+	return msg;
+}
+
+vector<IOTMessage> ReadingSeries::decodeBlock(size_t index) const {
+	State state;
+	return decodeBlock(blocks[index], state);
+}
+
+/**
+ * Encode the block again with the given readings (e.g. some of them were removed).
+ * Block without readings is removed.
+ */
+void ReadingSeries::replaceBlock(size_t index, const vector<IOTMessage> &msgs) {
+	bool last = (index + 1 == blocks.size());
+
+	count = count - blocks[index].count + msgs.size();
+	if (msgs.empty()) {
+		blocks.erase(blocks.begin() + index);
+		if (last)
+			restoreTail();
+		return;
+	}
+
+	Block block;
+	State state;
+	for (const IOTMessage &msg : msgs)
+		encode(block, state, msg);
+
+	if (last)
+		tail = state;
+	else
+		block.data.shrink_to_fit();
+	blocks[index] = block;
+}
+
+vector<IOTMessage> ReadingSeries::decode() const {
+	vector<IOTMessage> msgs;
+
+	for (const Block &block : blocks) {
+		State state;
+		vector<IOTMessage> block_msgs = decodeBlock(block, state);
+		msgs.insert(msgs.end(), block_msgs.begin(), block_msgs.end());
+	}
+	return msgs;
+}
+
+/**
+ * Estimate memory occupied by the series.
+ */
+size_t ReadingSeries::footprint() const {
+	size_t size = header.state.capacity() + header.adapter_id.capacity() + header.fw_version.capacity()
+		+ header.protocol_version.capacity() + header.device.name.capacity();
+
+	size += tail.values.capacity() * sizeof(Value) + (tail.leading.capacity() + tail.trailing.capacity()) * sizeof(int);
+	for (const Block &block : blocks)
+		size += sizeof(Block) + block.data.capacity();
+
+	return size;
+}
+
+/**
+ * Encode reading to the block. The first reading of the block is stored as it is,
+ * timestamp of the next one as delta-of-delta (0 bits for readings with regular period),
+ * sequence number as a flag when it follows the previous one and every value as XOR with
+ * the previous value of the same module (only its meaningful bits).
+ */
+void ReadingSeries::encode(Block &block, State &state, const IOTMessage &msg) const {
+	vector<uint8_t> &data = block.data;
+	size_t &bits = block.bits;
+
+	if (state.count == 0) {
+		putBits(data, bits, msg.time, 64);
+		putBits(data, bits, msg.seq, 64);
+		state.delta = 0;
+	}
+	else {
+		long long int delta = msg.time - state.time;
+		long long int dod = delta - state.delta;
+
+		if (dod == 0) {
+			putBits(data, bits, 0, 1);
+		}
+		else if (dod >= -63 && dod <= 64) {
+			putBits(data, bits, 0x2, 2);
+			putBits(data, bits, dod + 63, 7);
+		}
+		else if (dod >= -255 && dod <= 256) {
+			putBits(data, bits, 0x6, 3);
+			putBits(data, bits, dod + 255, 9);
+		}
+		else if (dod >= -2047 && dod <= 2048) {
+			putBits(data, bits, 0xE, 4);
+			putBits(data, bits, dod + 2047, 12);
+		}
+		else {
+			putBits(data, bits, 0xF, 4);
+			putBits(data, bits, dod, 64);
+		}
+		state.delta = delta;
+
+		if (msg.seq == state.seq + 1) {
+			putBits(data, bits, 0, 1);
+		}
+		else {
+			putBits(data, bits, 1, 1);
+			putBits(data, bits, msg.seq, 64);
+		}
+	}
+	state.time = msg.time;
+	state.seq = msg.seq;
+
+	const vector<Value> &values = msg.device.values;
+	bool same_layout = (state.count > 0 && values.size() == state.values.size());
+	for (unsigned int i = 0; same_layout && i < values.size(); i++)
+		same_layout = (values[i].mid == state.values[i].mid);
+
+	if (same_layout) {
+		putBits(data, bits, 0, 1);
+	}
+	else {
+		putBits(data, bits, 1, 1);
+		putBits(data, bits, values.size(), 8);
+		for (const Value &value : values)
+			putBits(data, bits, (uint32_t) value.mid, 32);
+		state.leading.assign(values.size(), -1);
+		state.trailing.assign(values.size(), 0);
+	}
+
+	for (unsigned int i = 0; i < values.size(); i++) {
+		uint32_t value = floatBits(values[i].value);
+
+		putBits(data, bits, values[i].status ? 1 : 0, 1);
+		if (!same_layout) {
+			putBits(data, bits, value, 32);
+			continue;
+		}
+
+		uint32_t xored = value ^ floatBits(state.values[i].value);
+		if (xored == 0) {
+			putBits(data, bits, 0, 1);
+			continue;
+		}
+		putBits(data, bits, 1, 1);
+
+		int leading = __builtin_clz(xored);
+		int trailing = __builtin_ctz(xored);
+		if (state.leading[i] >= 0 && leading >= state.leading[i] && trailing >= state.trailing[i]) {
+			// Meaningful bits fit into the window of the previous value
+			putBits(data, bits, 0, 1);
+			putBits(data, bits, xored >> state.trailing[i], 32 - state.leading[i] - state.trailing[i]);
+		}
+		else {
+			int length = 32 - leading - trailing;
+			putBits(data, bits, 1, 1);
+			putBits(data, bits, leading, 5);
+			putBits(data, bits, length - 1, 5);
+			putBits(data, bits, xored >> trailing, length);
+			state.leading[i] = leading;
+			state.trailing[i] = trailing;
+		}
+	}
+	state.values = values;
+	state.count++;
+
+	if (block.count == 0)
+		block.first_time = msg.time;
+	block.last_time = msg.time;
+	block.count++;
+}
+
+/**
+ * Decode reading encoded by encode().
+ */
+IOTMessage ReadingSeries::decodeNext(const Block &block, size_t &pos, State &state) const {
+	const vector<uint8_t> &data = block.data;
+
+	if (state.count == 0) {
+		state.time = getBits(data, pos, 64);
+		state.seq = getBits(data, pos, 64);
+		state.delta = 0;
+	}
+	else {
+		long long int dod;
+
+		if (getBits(data, pos, 1) == 0)
+			dod = 0;
+		else if (getBits(data, pos, 1) == 0)
+			dod = (long long int) getBits(data, pos, 7) - 63;
+		else if (getBits(data, pos, 1) == 0)
+			dod = (long long int) getBits(data, pos, 9) - 255;
+		else if (getBits(data, pos, 1) == 0)
+			dod = (long long int) getBits(data, pos, 12) - 2047;
+		else
+			dod = getBits(data, pos, 64);
+
+		state.delta += dod;
+		state.time += state.delta;
+
+		if (getBits(data, pos, 1) == 0)
+			state.seq++;
+		else
+			state.seq = getBits(data, pos, 64);
+	}
+
+	bool same_layout = (getBits(data, pos, 1) == 0);
+	if (!same_layout) {
+		unsigned int size = getBits(data, pos, 8);
+
+		state.values.assign(size, Value());
+		for (Value &value : state.values)
+			value.mid = (int32_t) getBits(data, pos, 32);
+		state.leading.assign(size, -1);
+		state.trailing.assign(size, 0);
+	}
+
+	for (unsigned int i = 0; i < state.values.size(); i++) {
+		Value &value = state.values[i];
+
+		value.status = (getBits(data, pos, 1) != 0);
+		if (!same_layout) {
+			value.value = bitsFloat(getBits(data, pos, 32));
+			continue;
+		}
+		if (getBits(data, pos, 1) == 0)
+			continue;
+
+		if (getBits(data, pos, 1) != 0) {
+			state.leading[i] = getBits(data, pos, 5);
+			state.trailing[i] = 32 - state.leading[i] - (getBits(data, pos, 5) + 1);
+		}
+		uint32_t xored = getBits(data, pos, 32 - state.leading[i] - state.trailing[i]) << state.trailing[i];
+		value.value = bitsFloat(floatBits(value.value) ^ xored);
+	}
+	state.count++;
+
+	IOTMessage msg = header;
+	msg.time = state.time;
+	msg.seq = state.seq;
+	msg.device.values = state.values;
+	msg.device.pairs = state.values.size();
+	return msg;
+}
+
+vector<IOTMessage> ReadingSeries::decodeBlock(const Block &block, State &state) const {
+	vector<IOTMessage> msgs;
+	size_t pos = 0;
+
+	for (unsigned int i = 0; i < block.count; i++)
+		msgs.push_back(decodeNext(block, pos, state));
+	return msgs;
+}
+
+/**
+ * Compute state of the encoder after the last reading, so new readings can be appended.
+ */
+void ReadingSeries::restoreTail() {
+	tail = State();
+	if (!blocks.empty())
+		decodeBlock(blocks.back(), tail);
+}
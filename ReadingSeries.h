@@ -0,0 +1,88 @@
+/**
+ * @file ReadingSeries.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Compressed readings of one device in the message cache
+ */
+
+#ifndef READINGSERIES_H
+#define	READINGSERIES_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "utils.h"
+
+// Maximal number of readings encoded in one block
+#define SERIES_BLOCK_SIZE 64
+
+/**
+ * Readings of one device with the same header (protocol, firmware, device type, priority)
+ * stored in compressed blocks. Only the values, timestamp and sequence number of every
+ * reading are stored, timestamps are encoded as delta-of-delta and values are XORed with
+ * the previous value of the same module. Every block is encoded independently, so readings
+ * are taken from both ends of the series by decoding and encoding of one block.
+ * Readings are appended in the order of their timestamps.
+ */
+class ReadingSeries {
+public:
+	ReadingSeries(const IOTMessage &msg);
+
+	static bool eligible(const IOTMessage &msg);
+	bool append(const IOTMessage &msg);
+
+	bool empty() const { return count == 0; }
+	std::size_t size() const { return count; }
+	long long int firstTime() const { return blocks.front().first_time; }
+	long long int lastTime() const { return blocks.back().last_time; }
+
+	IOTMessage popFront();
+	IOTMessage popBack();
+
+	std::size_t blockCount() const { return blocks.size(); }
+	std::vector<IOTMessage> decodeBlock(std::size_t index) const;
+	void replaceBlock(std::size_t index, const std::vector<IOTMessage> &msgs);
+	std::vector<IOTMessage> decode() const;
+
+	std::size_t footprint() const;
+
+private:
+	struct Block {
+		Block() : bits(0), count(0), first_time(0), last_time(0) {}
+
+		std::vector<uint8_t> data;
+		std::size_t bits;
+		unsigned int count;
+		long long int first_time;
+		long long int last_time;
+	};
+
+	/**
+	 * Previous reading of the block, encoder and decoder predict the next reading from it.
+	 */
+	struct State {
+		State() : count(0), time(0), delta(0), seq(0) {}
+
+		unsigned int count;
+		long long int time;
+		long long int delta;
+		uint64_t seq;
+		std::vector<Value> values;
+		std::vector<int> leading;       // leading zeros of the last XOR of every value (-1 = none)
+		std::vector<int> trailing;      // trailing zeros of the last XOR of every value
+	};
+
+	bool matches(const IOTMessage &msg) const;
+	void encode(Block &block, State &state, const IOTMessage &msg) const;
+	IOTMessage decodeNext(const Block &block, std::size_t &pos, State &state) const;
+	std::vector<IOTMessage> decodeBlock(const Block &block, State &state) const;
+	void restoreTail();
+
+	IOTMessage header;          // message without values shared by all readings
+	std::deque<Block> blocks;
+	State tail;                 // state after the last reading of the last block
+	std::size_t count;
+};
+
+#endif	/* READINGSERIES_H */
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <Poco/Runnable.h>
 
@@ -15,5 +16,14 @@
 class ServerConnector : public Poco::Runnable {
 public:
 	virtual std::pair<bool, Command> sendToServer(IOTMessage _msg) = 0;
+	/**
+	 * Send more data messages in one envelope. Devices processed by the server
+	 * are listed in Command::acks of the response, empty list acknowledges all of them.
+	 */
+	virtual std::pair<bool, Command> sendBatchToServer(const std::vector<IOTMessage> &batch) = 0;
 	virtual void run() = 0;
+	/**
+	 * Interrupt blocking operations of run(), called on exit after quit_global_flag is set.
+	 */
+	virtual void stop() {}
 };
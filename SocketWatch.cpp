@@ -0,0 +1,134 @@
+/**
+ * @file SocketWatch.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Waiting for data of a socket
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "SocketWatch.h"
+
+#define SOCKETWATCH_POLL_TIMEOUT 1000 // milliseconds, only without epoll
+
+SocketWatch::SocketWatch() :
+	epoll_fd(-1),
+	wakeup_fd(-1),
+	socket_fd(-1),
+	log(Poco::Logger::get("Adaapp-TCP"))
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = wakeup_fd;
+
+	if (epoll_fd < 0 || wakeup_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event) < 0) {
+		log.warning("Sockets cannot be watched by epoll: " + std::string(strerror(errno)));
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+		if (wakeup_fd >= 0)
+			close(wakeup_fd);
+		epoll_fd = -1;
+		wakeup_fd = -1;
+	}
+}
+
+SocketWatch::~SocketWatch() {
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	if (wakeup_fd >= 0)
+		close(wakeup_fd);
+}
+
+/**
+ * Watch the socket instead of the previous one.
+ * @param socket File descriptor of the socket
+ */
+bool SocketWatch::watch(int socket) {
+	unwatch();
+	socket_fd = socket;
+
+	if (epoll_fd < 0)
+		return true;
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.fd = socket;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &event) < 0) {
+		log.error("Cannot watch socket: " + std::string(strerror(errno)));
+		socket_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Stop watching the socket, it has to be called before the socket is closed.
+ */
+void SocketWatch::unwatch() {
+	if (socket_fd >= 0 && epoll_fd >= 0)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket_fd, NULL);
+	socket_fd = -1;
+}
+
+/**
+ * Wait until the watched socket is readable or wakeUp() is called. Without epoll
+ * (or when epoll fails), the wait is limited by a timeout, so the caller can check for exit.
+ */
+SocketWatch::Event SocketWatch::wait() {
+	if (epoll_fd < 0) {
+		struct pollfd pfd;
+		pfd.fd = socket_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (socket_fd < 0) {
+			usleep(SOCKETWATCH_POLL_TIMEOUT * 1000);
+			return TIMEOUT;
+		}
+		return poll(&pfd, 1, SOCKETWATCH_POLL_TIMEOUT) > 0 ? SOCKET_READABLE : TIMEOUT;
+	}
+
+	struct epoll_event events[2];
+	int count;
+	do {
+		count = epoll_wait(epoll_fd, events, 2, -1);
+	} while (count < 0 && errno == EINTR);
+
+	if (count < 0) {
+		log.error("Waiting for socket failed: " + std::string(strerror(errno)));
+		usleep(SOCKETWATCH_POLL_TIMEOUT * 1000);
+		return TIMEOUT;
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (events[i].data.fd == wakeup_fd)
+			return WOKEN_UP;
+	}
+	return SOCKET_READABLE;
+}
+
+/**
+ * Interrupt the waiting thread. The wakeup stays signalled, so every following
+ * wait() returns immediately.
+ */
+void SocketWatch::wakeUp() {
+	if (wakeup_fd < 0)
+		return;
+
+	uint64_t value = 1;
+	if (write(wakeup_fd, &value, sizeof(value)) < 0)
+		log.error("Cannot wake up socket watch: " + std::string(strerror(errno)));
+}
@@ -0,0 +1,45 @@
+/**
+ * @file SocketWatch.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Waiting for data of a socket
+ */
+
+#ifndef SOCKETWATCH_H
+#define	SOCKETWATCH_H
+
+#include <Poco/Logger.h>
+
+/**
+ * Wait for data of one socket with epoll, so an idle connection does not wake up
+ * the waiting thread. The wait is interrupted by wakeUp() (eventfd), e.g. on exit
+ * of the application. When epoll is not available, waiting falls back to polling
+ * of the socket with a timeout.
+ */
+class SocketWatch {
+public:
+	enum Event {
+		SOCKET_READABLE,    // socket has data, is closed or failed
+		WOKEN_UP,           // wakeUp() was called
+		TIMEOUT             // only without epoll
+	};
+
+	SocketWatch();
+	~SocketWatch();
+
+	SocketWatch(const SocketWatch&) = delete;
+	SocketWatch& operator=(const SocketWatch&) = delete;
+
+	bool watch(int socket);
+	void unwatch();
+	Event wait();
+	void wakeUp();
+
+private:
+	int epoll_fd;
+	int wakeup_fd;
+	int socket_fd;          // watched socket (-1 = none)
+	Poco::Logger& log;
+};
+
+#endif	/* SOCKETWATCH_H */
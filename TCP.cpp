@@ -7,8 +7,11 @@
 
 #include <utility>
 
+#include <poll.h>
+
 #include <Poco/AutoPtr.h>
 #include <Poco/Event.h>
+#include <Poco/Net/SSLManager.h>
 #include <Poco/Net/SocketAddress.h>
 
 #include "IOcontrol.h"
@@ -18,6 +21,7 @@
 using namespace std;
 using namespace Poco::Net;
 using Poco::AutoPtr;
+using Poco::FastMutex;
 using Poco::Logger;
 using Poco::Mutex;
 using Poco::Runnable;
@@ -27,6 +31,9 @@ using Poco::Util::IniFileConfiguration;
 
 #define RECONNECT_TIME 5  // seconds
 #define RECEIVE_TIMEOUT 3 // seconds
+#define PIPELINE_TIMEOUT 10 // seconds to wait for the response of pipelined request
+#define PIPELINE_POLL_TIMEOUT 1000 // milliseconds to wait for data of the pipeline connection
+#define PIPELINE_READ_TIMEOUT 50 // milliseconds to read the pipeline connection while writers wait for it
 
 /**
  * Thread function for sending data to server (to not to block receiving thread)
@@ -72,7 +79,12 @@ IOTReceiver::IOTReceiver(shared_ptr<Aggregator> _agg, string _address, int _port
 	port(_port),
 	msg(_msg),
 	adapter_id(_adapter_id),
-	log(Poco::Logger::get("Adaapp-TCP"))
+	log(Poco::Logger::get("Adaapp-TCP")),
+	keepalive_enable(false),
+	max_idle_connections(0),
+	idle_timeout(60),
+	pipelining(false),
+	last_request_id(0)
 {
 	keepalive = {0,0,0};
 	input_socket = nullptr;
@@ -107,9 +119,20 @@ void IOTReceiver::keepaliveInit(IniFileConfiguration * cfg) {
 	}
 }
 
+/**
+ * Read how many connections for messages to the server are kept open, so the TCP
+ * and TLS handshake is not done for every message. With pipelining, all messages
+ * are sent over one connection without waiting for the previous response.
+ */
+void IOTReceiver::connectionPoolInit(IniFileConfiguration * cfg) {
+	max_idle_connections = cfg->getInt("server.persistent_connections", 0);
+	idle_timeout = cfg->getInt("server.idle_timeout", 60);    // in seconds
+	pipelining = cfg->getBool("server.pipelining", false);
+}
+
 void IOTReceiver::init() {
 	SocketAddress srv_address(address, port);
-	input_socket.reset(new SecureStreamSocket(srv_address));
+	input_socket = openSocket(srv_address);
 	unique_ptr<XMLTool> xml(new XMLTool(ServerMessage(msg)));
 	string message = xml->createXML(INIT);
 	char buffer[2000] = {0};
@@ -136,6 +159,10 @@ void IOTReceiver::run() {
 	send_semaphore.reset(new Semaphore(0,10));
 	queue_mutex.reset(new Mutex());
 	send_thread.reset (new std::thread(referMessageFromServer, send_queue, std::pair<shared_ptr<Aggregator>, Poco::Logger&>(agg, log), send_semaphore, queue_mutex));
+	if (pipelining)
+		pipeline_thread.reset(new std::thread(&IOTReceiver::runPipeline, this));
+
+	FrameParser frames;		// messages received from the server
 	while ( !quit_global_flag ) {
 		if ( input_socket.get() == nullptr ) {
 			try {
@@ -143,11 +170,16 @@ void IOTReceiver::run() {
 #ifdef LEDS_ENABLED
 				LEDControl::blinkLED(LED_LIME);
 #endif
-				if (input_socket.get() != nullptr)
-					input_socket->setReceiveTimeout(Poco::Timespan(RECEIVE_TIMEOUT,0));
+				// Timeout only limits reading of an incomplete TLS record, data are waited for by socket_watch
+				input_socket->setReceiveTimeout(Poco::Timespan(RECEIVE_TIMEOUT,0));
+				if (!socket_watch.watch(input_socket->impl()->sockfd()))
+					throw Poco::IOException("cannot watch connection to server");
+				frames.clear();
 			}
 			catch (Poco::Exception& exc) {
 				log.error("Exception: " + exc.displayText());
+				socket_watch.unwatch();
+				input_socket.reset(nullptr);
 #ifdef LEDS_ENABLED
 				LEDControl::setLED(LED_LIME, false);
 #endif
@@ -160,119 +192,154 @@ void IOTReceiver::run() {
 			}
 		}
 
-		try {
-			MSG_TYPE ret;		// variable for the message residue
-			try {
-				int n = 0;
-				// XXX This while should have some maximum message size counter,
-				// otherwise it will cycle until \0 will be found
-				while ((n >= 0) && (!quit_global_flag)) {
-				  MSG_TYPE buffer (BUF_SIZE);
-					try {
-						n = input_socket->receiveBytes(buffer.data(), buffer.size());
-					}
-					catch (Poco::TimeoutException& t_ex) {
-						n = 0;
-					}
-					// Check for timeout expiration for receive bytes
-					if (n > 0) {
-						buffer.resize(n);
-						ret.insert(ret.end(), buffer.begin(), buffer.end()); // Concatenate vector
-						ret = parseTempMessage(ret);
-					}
-
-				}
-				if (quit_global_flag)
-					return;
+		if (socket_watch.wait() != SocketWatch::SOCKET_READABLE)
+			continue;
 
-				if ( n <= 0 ) {
-					input_socket.reset(nullptr);
-					continue;
+		bool closed = false;
+		try {
+			// TLS can hold decrypted data which are not visible to socket_watch, read all of them
+			do {
+				char *data;
+				size_t space = frames.space(data);
+				int n = input_socket->receiveBytes(data, space);
+				if (n <= 0) {
+					closed = true;
+					break;
 				}
+				frames.commit(n);
+				parseFrames(frames);
+			} while (input_socket->available() > 0);
+		}
+		catch (Poco::TimeoutException&) {
+			// Socket was readable without a complete TLS record
+		}
+		catch (Poco::Exception& exc) {
+			log.error("Exception: " + exc.displayText());
+			closed = true;
+		}
 
-				// It is possible that receiveBytes returned 0 - try to parse message again if there is something
-				if (ret.size())
-					parseTempMessage(ret);
-
-			} catch (Poco::Exception& exc) {
-				log.error("Exception: " + exc.displayText());
-				input_socket.reset(nullptr);
-			}
-			if ( input_socket.get() == nullptr )
-				 continue;
-
-		} catch (Poco::Exception& ex) {
-			log.error("Exception: " + ex.displayText());
+		if (closed) {
+			socket_watch.unwatch();
+			input_socket.reset(nullptr);
 		}
 	}
+	socket_watch.unwatch();
 }
 
 /**
- * Parse temporary buffer from server. Delimiter is found, message is parsed and sent to other parts.
- * @param tmp_msg Message which will be parsed
- * @param delimiter Delimiter character
- * @return residue after parsing
+ * Interrupt waiting for commands of the server, so run() can exit.
  */
-MSG_TYPE IOTReceiver::parseTempMessage(MSG_TYPE tmp_msg, char delimiter) {
-	MSG_TYPE::iterator it = tmp_msg.end();
-
-	while ((it = std::find(tmp_msg.begin(), tmp_msg.end(), delimiter) ) != tmp_msg.end()) {		// Try to find delimiter
-		std::string partial_msg(tmp_msg.begin(), it++);
-		if (!partial_msg.empty()) { // Partial message might be empty
-			log.information("Incomming message:\n" + partial_msg);
-
-			queue_mutex->lock();
-			send_queue->push(partial_msg);
-			queue_mutex->unlock();
-			send_semaphore->set();
-		}
-		tmp_msg.erase(tmp_msg.begin(), it);
-	}
-	return tmp_msg;
+void IOTReceiver::stop() {
+	socket_watch.wakeUp();
+}
+
+/**
+ * Take complete messages received from server and pass them to the thread handling commands.
+ * @param frames Data received from server
+ */
+void IOTReceiver::parseFrames(FrameParser &frames) {
+	unsigned int dropped = frames.extract([this](const char *data, size_t length) {
+		if (length == 0) // Partial message might be empty
+			return;
+
+		std::string message(data, length);
+		log.information("Incomming message:\n" + message);
+
+		queue_mutex->lock();
+		send_queue->push(message);
+		queue_mutex->unlock();
+		send_semaphore->set();
+	});
+
+	if (dropped > 0)
+		log.warning("Dropped " + to_string(dropped) + " messages from server longer than " + to_string(FRAME_MAX_SIZE) + " bytes.");
 }
 
 IOTReceiver::~IOTReceiver() {
 	send_semaphore->set();
 	send_thread->join();
+	if (pipeline_thread)
+		pipeline_thread->join();
 }
 
 pair<bool, Command> IOTReceiver::sendToServer(IOTMessage _msg) {
-	Command income_cmd;
 	if (_msg.state == "")
 		_msg.state = "data";
-	unique_ptr<XMLTool> xml(new XMLTool(ServerMessage(_msg)));
+	ServerMessage sMessage(_msg);
+	if (pipelining)
+		sMessage.request_id = generateRequestId();
+
+	unique_ptr<XMLTool> xml(new XMLTool(sMessage));
 	string a_to_s = "";
 	if(_msg.state == "getparameters" || _msg.state == "parameters")
 		a_to_s = xml->createXML(PARAM);
 	else
 		a_to_s = xml->createXML(A_TO_S);
 
+	if (pipelining)
+		return pipelineRequest(sMessage.request_id, a_to_s);
+	return exchangeWithServer(a_to_s);
+}
+
+pair<bool, Command> IOTReceiver::sendBatchToServer(const vector<IOTMessage> &batch) {
+	ServerMessage envelope(batch.front());
+	envelope.iotmessage.state = "data";
+	envelope.iotmessage.time = time(NULL);
+	if (pipelining)
+		envelope.request_id = generateRequestId();
+
+	unique_ptr<XMLTool> xml(new XMLTool(envelope));
+	if (pipelining)
+		return pipelineRequest(envelope.request_id, xml->createBatchXML(batch));
+	return exchangeWithServer(xml->createBatchXML(batch));
+}
+
+/**
+ * Send message to server and process its response. Connection kept open after
+ * the previous message is used when there is any, a new connection is opened
+ * otherwise. When the kept connection fails before the message is sent, the message
+ * is sent again over a new connection. Once it was sent, the server might have
+ * received it and it is not sent again (failed data messages are retried later
+ * and the server recognizes them by their seq).
+ * @param a_to_s Message in XML
+ * @return Pair of success flag and command from the response
+ */
+pair<bool, Command> IOTReceiver::exchangeWithServer(const string &a_to_s) {
+	Command income_cmd;
+
 	log.information("Try to send this MSG to server:\n" + a_to_s);
 
 #ifdef LEDS_ENABLED
 	LEDControl::setLED(LED_PAN, true);
 #endif
-	SocketAddress sa(address, port);
 	try {
-		SecureStreamSocket str(sa);
-		str.sendBytes(a_to_s.c_str(), a_to_s.length());
-		str.setReceiveTimeout(Poco::Timespan(RECEIVE_TIMEOUT,0));
-
-		char buffer[BUF_SIZE];
+		unique_ptr<SecureStreamSocket> socket = takeConnection();
 		string message = "";
-		int n = 0;
+		bool answered = false;
+		bool reusable = false;
 
-		do {
-			 n = str.receiveBytes(buffer, sizeof(buffer));
-			 message += string(buffer, n);
-			 // XXX Temporary solution to handle case with NULL byte
-			 // at the end of the message
-			 auto pos = message.find('\0');
-			 if (pos != message.npos) {
-				 message.erase(pos);
-				 break;
-			 }
-		} while (n == BUF_SIZE);
+		if (socket) {
+			bool sent = false;
+			try {
+				answered = exchange(*socket, a_to_s, message, sent, reusable);
+			}
+			catch (Poco::Exception& ex) {
+				if (sent)
+					throw;
+				log.information("Kept connection to server failed (" + ex.displayText() + "), reconnecting.");
+			}
+			if (!answered && sent) {
+				log.warning("Kept connection closed by server before the response.");
+				throw Poco::IOException("connection closed by server");
+			}
+		}
+		if (!answered) {
+			bool sent;
+			socket = connect();
+			answered = exchange(*socket, a_to_s, message, sent, reusable);
+		}
+		if (answered && reusable)
+			releaseConnection(std::move(socket));
 
 #ifdef LEDS_ENABLED
 		LEDControl::setLEDAfterTimeout(LED_PAN, false, 200000);
@@ -291,7 +358,366 @@ pair<bool, Command> IOTReceiver::sendToServer(IOTMessage _msg) {
 		}
 	}
 	catch (Poco::Exception& ex) {
+#ifdef LEDS_ENABLED
+		LEDControl::setLED(LED_PAN, false);
+#endif
 		return make_pair(false, income_cmd);
 	}
 	return make_pair(true, income_cmd);
 }
+
+/**
+ * Open a new connection to the server.
+ */
+unique_ptr<SecureStreamSocket> IOTReceiver::connect() {
+	SocketAddress sa(address, port);
+	unique_ptr<SecureStreamSocket> socket = openSocket(sa);
+
+	socket->setReceiveTimeout(Poco::Timespan(RECEIVE_TIMEOUT,0));
+	if ((max_idle_connections > 0 || pipelining) && keepalive_enable) {
+		socket->setKeepAlive(true);
+		socket->setOption(SOL_TCP, TCP_KEEPIDLE, keepalive.time);
+		socket->setOption(SOL_TCP, TCP_KEEPINTVL, keepalive.interval);
+		socket->setOption(SOL_TCP, TCP_KEEPCNT, keepalive.probes);
+	}
+	return socket;
+}
+
+/**
+ * Connect to the server resuming the last TLS session (full handshake is done
+ * when the server does not accept it). Session of the new connection is kept
+ * for the next one. Sessions are not resumed when ssl.session_cache is disabled.
+ */
+unique_ptr<SecureStreamSocket> IOTReceiver::openSocket(const SocketAddress &sa) {
+	if (!SSLManager::instance().defaultClientContext()->sessionCacheEnabled())
+		return unique_ptr<SecureStreamSocket>(new SecureStreamSocket(sa));
+
+	Session::Ptr session;
+	{
+		FastMutex::ScopedLock guard(session_lock);
+		session = tls_session;
+	}
+
+	unique_ptr<SecureStreamSocket> socket;
+	if (session.isNull())
+		socket.reset(new SecureStreamSocket(sa));
+	else
+		socket.reset(new SecureStreamSocket(sa, SSLManager::instance().defaultClientContext(), session));
+
+	if (socket->sessionWasReused())
+		log.debug("TLS session with server resumed.");
+
+	FastMutex::ScopedLock guard(session_lock);
+	tls_session = socket->currentSession();
+	return socket;
+}
+
+/**
+ * Take connection kept open after the previous message. Connection which is readable
+ * while idle was closed by the server (or it sent unexpected data), it is not used.
+ * @return NULL if there is no connection which has not been idle for too long
+ */
+unique_ptr<SecureStreamSocket> IOTReceiver::takeConnection() {
+	FastMutex::ScopedLock guard(idle_lock);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	while (!idle_connections.empty()) {
+		unique_ptr<SecureStreamSocket> socket = std::move(idle_connections.back().first);
+		std::chrono::steady_clock::time_point released = idle_connections.back().second;
+		idle_connections.pop_back();
+
+		if (now - released >= std::chrono::seconds(idle_timeout))
+			continue;
+
+		struct pollfd pfd;
+		pfd.fd = socket->impl()->sockfd();
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) == 0)
+			return socket;
+	}
+	return nullptr;
+}
+
+/**
+ * Keep connection open for the next message, it is closed when there are
+ * server.persistent_connections connections already.
+ */
+void IOTReceiver::releaseConnection(unique_ptr<SecureStreamSocket> socket) {
+	FastMutex::ScopedLock guard(idle_lock);
+
+	if (idle_connections.size() < max_idle_connections)
+		idle_connections.push_back(make_pair(std::move(socket), std::chrono::steady_clock::now()));
+}
+
+/**
+ * Send message over the connection and receive its response. When connections are
+ * kept open, the response is terminated by NULL byte. Server which does not terminate
+ * it is recognized by the end of the root element, its connection is not kept as
+ * the NULL byte could still come. Otherwise the response ends by a short read
+ * (or by NULL byte) as the server always closes the connection after it.
+ * @param response Response without the terminating NULL byte
+ * @param sent Set when the whole message was sent
+ * @param reusable Set when the connection can be kept for the next message
+ * @return false if the server closed the kept connection before the complete response
+ */
+bool IOTReceiver::exchange(SecureStreamSocket &socket, const string &a_to_s, string &response, bool &sent, bool &reusable) {
+	char buffer[BUF_SIZE];
+	int n = 0;
+
+	response = "";
+	sent = false;
+	reusable = false;
+	socket.sendBytes(a_to_s.c_str(), a_to_s.length());
+	sent = true;
+
+	if (max_idle_connections == 0) {
+		do {
+			n = socket.receiveBytes(buffer, sizeof(buffer));
+			response += string(buffer, std::max(n, 0));
+		} while (n == BUF_SIZE && response.find('\0') == response.npos);
+
+		response.erase(std::min(response.find('\0'), response.length()));
+		return true;
+	}
+
+	do {
+		n = socket.receiveBytes(buffer, sizeof(buffer));
+		response += string(buffer, std::max(n, 0));
+
+		auto pos = response.find('\0');
+		if (pos != response.npos) {
+			response.erase(pos);
+			reusable = true;
+			return true;
+		}
+		if (isCompleteResponse(response))
+			return true;
+	} while (n > 0);
+
+	return false;
+}
+
+/**
+ * Check whether the response contains the whole root element <server_adapter>.
+ */
+bool IOTReceiver::isCompleteResponse(const string &response) {
+	size_t root = response.find("<server_adapter");
+	if (root == response.npos)
+		return false;
+
+	size_t end = response.find('>', root);
+	if (end == response.npos)
+		return false;
+	if (response[end - 1] == '/')
+		return true;
+
+	return response.find("</server_adapter>", end) != response.npos;
+}
+
+request_id_t IOTReceiver::generateRequestId() {
+	request_id_t request_id = ++last_request_id;
+
+	if (request_id == 0) // skip zero, invalid ID
+		request_id = ++last_request_id;
+	return request_id;
+}
+
+/**
+ * Send request over the pipeline connection and wait for the response with matching
+ * response_id. Other requests can be sent while this one waits for its response.
+ * @param request_id Identifier of the request contained in a_to_s
+ * @param a_to_s Message in XML
+ * @return Pair of success flag and command from the response
+ */
+pair<bool, Command> IOTReceiver::pipelineRequest(request_id_t request_id, const string &a_to_s) {
+	std::future<pair<bool, ServerCommand>> response;
+
+	log.information("Try to send this MSG to server:\n" + a_to_s);
+
+#ifdef LEDS_ENABLED
+	LEDControl::setLED(LED_PAN, true);
+#endif
+	if (!writePipeline(request_id, a_to_s, response)) {
+#ifdef LEDS_ENABLED
+		LEDControl::setLED(LED_PAN, false);
+#endif
+		return make_pair(false, Command());
+	}
+
+	if (response.wait_for(std::chrono::seconds(PIPELINE_TIMEOUT)) != std::future_status::ready) {
+		FastMutex::ScopedLock guard(pending_lock);
+
+		// The response could come right after the timeout, it is used then
+		if (pending_requests.erase(request_id) > 0) {
+			log.warning("No response to request " + to_string(request_id) + " from server.");
+#ifdef LEDS_ENABLED
+			LEDControl::setLED(LED_PAN, false);
+#endif
+			return make_pair(false, Command());
+		}
+	}
+
+#ifdef LEDS_ENABLED
+	LEDControl::setLEDAfterTimeout(LED_PAN, false, 200000);
+#endif
+
+	pair<bool, ServerCommand> answer = response.get();
+	if (answer.first)
+		agg->parseCmd(answer.second.command);
+	return make_pair(answer.first, answer.second.command);
+}
+
+/**
+ * Register the request as pending and write it to the pipeline connection,
+ * the connection is opened when there is none.
+ * @param response Future response of the request
+ * @return false if the request cannot be written
+ */
+bool IOTReceiver::writePipeline(request_id_t request_id, const string &a_to_s, std::future<pair<bool, ServerCommand>> &response) {
+	FastMutex::ScopedLock guard(pipeline_lock);
+
+	try {
+		if (!pipeline_socket) {
+			pipeline_socket.reset(connect().release());
+			// Readable socket can still lack the rest of TLS record, the lock is not held for long
+			pipeline_socket->setReceiveTimeout(Poco::Timespan(0, PIPELINE_READ_TIMEOUT * 1000));
+			pipeline_event.set();
+			log.information("Pipeline connection to server opened.");
+		}
+
+		{
+			FastMutex::ScopedLock pending_guard(pending_lock);
+			response = pending_requests[request_id].get_future();
+		}
+		pipeline_socket->sendBytes(a_to_s.c_str(), a_to_s.length());
+	}
+	catch (Poco::Exception& ex) {
+		log.error("Cannot send request to server: " + ex.displayText());
+
+		FastMutex::ScopedLock pending_guard(pending_lock);
+		pending_requests.erase(request_id);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Close the pipeline connection, its pending requests fail. Requests are written
+ * under the pipeline lock, so all pending requests were sent over this connection.
+ * @param socket Connection which failed (NULL closes any connection)
+ */
+void IOTReceiver::closePipeline(shared_ptr<SecureStreamSocket> socket) {
+	FastMutex::ScopedLock guard(pipeline_lock);
+
+	if (socket && socket != pipeline_socket)
+		return;
+	pipeline_socket.reset();
+
+	FastMutex::ScopedLock pending_guard(pending_lock);
+	if (!pending_requests.empty())
+		log.warning("Pipeline connection closed with " + to_string(pending_requests.size()) + " pending requests.");
+	for (auto &request : pending_requests)
+		request.second.set_value(make_pair(false, ServerCommand()));
+	pending_requests.clear();
+}
+
+/**
+ * Thread function receiving responses from the pipeline connection.
+ */
+void IOTReceiver::runPipeline() {
+	FrameParser frames;
+
+	while (!quit_global_flag) {
+		shared_ptr<SecureStreamSocket> socket;
+		{
+			FastMutex::ScopedLock guard(pipeline_lock);
+			socket = pipeline_socket;
+		}
+		if (!socket) {
+			pipeline_event.tryWait(1000);
+			continue;
+		}
+
+		char *data;
+		size_t space = frames.space(data);
+		int n = 0;
+		try {
+			// TLS connection must not be read and written concurrently, so it is
+			// only polled without the lock. Data already decrypted are not polled.
+			// Read under the lock waits for PIPELINE_READ_TIMEOUT at most.
+			bool readable;
+			{
+				FastMutex::ScopedLock guard(pipeline_lock);
+				readable = socket->available() > 0;
+			}
+			if (!readable) {
+				struct pollfd pfd;
+				pfd.fd = socket->impl()->sockfd();
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+				if (poll(&pfd, 1, PIPELINE_POLL_TIMEOUT) <= 0)
+					continue;
+			}
+
+			FastMutex::ScopedLock guard(pipeline_lock);
+			n = socket->receiveBytes(data, space);
+		}
+		catch (Poco::TimeoutException&) {
+			continue;
+		}
+		catch (Poco::Exception& ex) {
+			log.error("Exception: " + ex.displayText());
+		}
+
+		if (n <= 0) {
+			closePipeline(socket);
+			frames.clear();
+			continue;
+		}
+
+		frames.commit(n);
+		unsigned int dropped = frames.extract([this](const char *frame, size_t length) {
+			if (length > 0)
+				acceptResponse(std::string(frame, length));
+		});
+		if (dropped > 0)
+			log.warning("Dropped " + to_string(dropped) + " responses from server longer than " + to_string(FRAME_MAX_SIZE) + " bytes.");
+	}
+	closePipeline(nullptr);
+}
+
+/**
+ * Pass response to its pending request. Message which is not a response is a command
+ * of the server, it is handled like commands received over the receiving connection.
+ */
+void IOTReceiver::acceptResponse(const string &message) {
+	ServerCommand cmd;
+
+	log.information("Received message:\n" + message);
+	try {
+		XMLTool xml;
+		cmd = xml.parseXML(message);
+	}
+	catch (Poco::Exception& ex) {
+		log.error("Exception: " + ex.displayText());
+		return;
+	}
+
+	if (cmd.response_id == 0) {
+		queue_mutex->lock();
+		send_queue->push(message);
+		queue_mutex->unlock();
+		send_semaphore->set();
+		return;
+	}
+
+	FastMutex::ScopedLock guard(pending_lock);
+	auto it = pending_requests.find(cmd.response_id);
+	if (it == pending_requests.end()) {
+		log.warning("Response to unknown request " + to_string(cmd.response_id) + " from server.");
+		return;
+	}
+	it->second.set_value(make_pair(true, cmd));
+	pending_requests.erase(it);
+}
@@ -10,26 +10,33 @@
 
 extern bool quit_global_flag;
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
 #include <memory>
 #include <queue>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include <Poco/Event.h>
 #include <Poco/Logger.h>
 #include <Poco/Mutex.h>
 #include <Poco/Net/SecureStreamSocket.h>
+#include <Poco/Net/Session.h>
 #include <Poco/Runnable.h>
 #include <Poco/Semaphore.h>
 #include <Poco/StringTokenizer.h>
 #include <Poco/Util/IniFileConfiguration.h>
 
 #include "Aggregator.h"
+#include "FrameParser.h"
 #include "ServerConnector.h"
+#include "SocketWatch.h"
 
 
-using MSG_TYPE = std::vector<char>;
-
 #define KEEPALIVE_TIME 900
 #define KEEPALIVE_INTERVAL 60
 #define KEEPALIVE_PROBES 8
@@ -46,6 +53,7 @@ struct KeepALive {
 class IOTReceiver : public ServerConnector {
 private:
 	std::unique_ptr<Poco::Net::SecureStreamSocket> input_socket;
+	SocketWatch socket_watch;             // waits for commands on input_socket
 
 	std::shared_ptr<Aggregator> agg;
 	std::string address;
@@ -59,17 +67,52 @@ private:
 	std::shared_ptr<std::queue<std::string>> send_queue;
 	std::shared_ptr<Poco::Mutex> queue_mutex;
 	std::shared_ptr<std::thread> send_thread;
+
+	// Connections for messages to the server kept open after their response
+	std::deque<std::pair<std::unique_ptr<Poco::Net::SecureStreamSocket>, std::chrono::steady_clock::time_point>> idle_connections;
+	Poco::FastMutex idle_lock;
+	unsigned int max_idle_connections;    // 0 = new connection for every message
+	unsigned int idle_timeout;            // seconds after which an idle connection is not used again
+
+	Poco::Net::Session::Ptr tls_session;  // the last TLS session with the server, resumed by new connections
+	Poco::FastMutex session_lock;
+
+	// Requests pipelined over one connection, responses are matched by their response_id
+	bool pipelining;
+	std::shared_ptr<Poco::Net::SecureStreamSocket> pipeline_socket;
+	Poco::FastMutex pipeline_lock;        // lock for pipeline_socket, held while writing to it or reading from it
+	Poco::Event pipeline_event;           // signalled when the pipeline connection is opened
+	std::map<request_id_t, std::promise<std::pair<bool, ServerCommand>>> pending_requests;
+	Poco::FastMutex pending_lock;
+	std::atomic<request_id_t> last_request_id;
+	std::shared_ptr<std::thread> pipeline_thread;
 public:
 		IOTReceiver(std::shared_ptr<Aggregator> _agg, std::string _address, int _port, IOTMessage _msg, long long int _adapter_id);
 		~IOTReceiver();
 		std::pair<bool, Command> sendToServer(IOTMessage _msg);
+		std::pair<bool, Command> sendBatchToServer(const std::vector<IOTMessage> &batch);
 
 		void keepaliveInit(Poco::Util::IniFileConfiguration * cfg);
+		void connectionPoolInit(Poco::Util::IniFileConfiguration * cfg);
 		void init();
 		void run();
+		void stop();
 private:
+		std::pair<bool, Command> exchangeWithServer(const std::string &a_to_s);
+		std::pair<bool, Command> pipelineRequest(request_id_t request_id, const std::string &a_to_s);
+		bool writePipeline(request_id_t request_id, const std::string &a_to_s, std::future<std::pair<bool, ServerCommand>> &response);
+		void closePipeline(std::shared_ptr<Poco::Net::SecureStreamSocket> socket);
+		void runPipeline();
+		void acceptResponse(const std::string &message);
+		request_id_t generateRequestId();
+		std::unique_ptr<Poco::Net::SecureStreamSocket> connect();
+		std::unique_ptr<Poco::Net::SecureStreamSocket> openSocket(const Poco::Net::SocketAddress &sa);
+		std::unique_ptr<Poco::Net::SecureStreamSocket> takeConnection();
+		void releaseConnection(std::unique_ptr<Poco::Net::SecureStreamSocket> socket);
+		bool exchange(Poco::Net::SecureStreamSocket &socket, const std::string &a_to_s, std::string &response, bool &sent, bool &reusable);
+		static bool isCompleteResponse(const std::string &response);
 		std::string parseTempMessage_alternative(std::string tmp_msg, char delimiter='\0');
-		MSG_TYPE parseTempMessage(MSG_TYPE tmp_msg, char delimiter='\0');
+		void parseFrames(FrameParser &frames);
 
 };
 
@@ -0,0 +1,99 @@
+/**
+ * @file TokenBucket.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Rate limiter of messages sent to the server
+ */
+
+#include <algorithm>
+
+#include "TokenBucket.h"
+
+using namespace std;
+using Poco::FastMutex;
+
+TokenBucket::TokenBucket(double _rate, double _burst) :
+	rate(_rate),
+	burst(max(_burst, 1.0)),
+	tokens(burst),
+	updated(chrono::steady_clock::now()),
+	paused_until(updated)
+{
+}
+
+/**
+ * Change the rate of the bucket, tokens which were already reserved are kept.
+ * @param _rate Tokens per second (0 = unlimited)
+ * @param _burst Maximum of tokens in the bucket
+ */
+void TokenBucket::setRate(double _rate, double _burst) {
+	FastMutex::ScopedLock guard(lock);
+
+	refill(chrono::steady_clock::now());
+	rate = max(_rate, 0.0);
+	burst = max(_burst, 1.0);
+	tokens = min(tokens, burst);
+}
+
+/**
+ * Stop handing out tokens for the given time. The bucket is empty when the pause ends,
+ * so the sending starts by the rate and not by a burst.
+ */
+void TokenBucket::pause(chrono::milliseconds delay) {
+	FastMutex::ScopedLock guard(lock);
+
+	paused_until = chrono::steady_clock::now() + delay;
+	updated = paused_until;
+	tokens = (rate > 0) ? 0 : burst;
+}
+
+/**
+ * Take tokens for the given number of messages.
+ * @return Time to wait before sending of the messages
+ */
+chrono::steady_clock::duration TokenBucket::reserve(unsigned int count) {
+	FastMutex::ScopedLock guard(lock);
+
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	chrono::steady_clock::time_point start = max(now, paused_until);
+
+	if (rate == 0)
+		return start - now;
+
+	refill(start);
+	tokens -= count;
+	if (tokens >= 0)
+		return start - now;
+
+	chrono::microseconds deficit((long long int) (-tokens * 1000000 / rate));
+	return start - now + deficit;
+}
+
+/**
+ * Return tokens reserved for messages which are not sent.
+ */
+void TokenBucket::release(unsigned int count) {
+	FastMutex::ScopedLock guard(lock);
+
+	if (rate > 0)
+		tokens = min(burst, tokens + count);
+}
+
+double TokenBucket::getRate() {
+	FastMutex::ScopedLock guard(lock);
+	return rate;
+}
+
+double TokenBucket::getBurst() {
+	FastMutex::ScopedLock guard(lock);
+	return burst;
+}
+
+void TokenBucket::refill(chrono::steady_clock::time_point now) {
+	if (now <= updated)
+		return;
+
+	double elapsed = chrono::duration_cast<chrono::microseconds>(now - updated).count() / 1000000.0;
+	tokens = min(burst, tokens + elapsed * rate);
+	updated = now;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file TokenBucket.h
+ * @Author BeeeOn team
+ * @date
+ * @brief Rate limiter of messages sent to the server
+ */
+
+#ifndef TOKENBUCKET_H
+#define	TOKENBUCKET_H
+
+#include <chrono>
+
+#include <Poco/Mutex.h>
+
+/**
+ * Token bucket shared by threads sending to the server. Tokens are refilled by the rate
+ * up to the burst, every sent message takes one token. A caller which takes more tokens
+ * than available is told how long to wait, so the messages leave evenly paced.
+ * The bucket can be paused, e.g. for a random delay after reconnection to the server.
+ */
+class TokenBucket {
+public:
+	TokenBucket(double rate = 0, double burst = 1);
+
+	void setRate(double rate, double burst);
+	void pause(std::chrono::milliseconds delay);
+	std::chrono::steady_clock::duration reserve(unsigned int count);
+	void release(unsigned int count);
+
+	double getRate();
+	double getBurst();
+
+private:
+	void refill(std::chrono::steady_clock::time_point now);
+
+	Poco::FastMutex lock;
+	double rate;            // tokens per second (0 = unlimited)
+	double burst;           // maximum of tokens in the bucket
+	double tokens;          // can be negative when the tokens are reserved in advance
+	std::chrono::steady_clock::time_point updated;      // time of the last refill
+	std::chrono::steady_clock::time_point paused_until;
+};
+
+#endif	/* TOKENBUCKET_H */
@@ -181,7 +181,7 @@ void VPTSensor::fetchAndSendMessage(map<euid_t, VPTDevice>::iterator &device)
 		if (createMsg(device->second)) {
 			log.notice("VPT: Sending values to server");
 			response = agg->sendData(msg);
-			if (response.first) {
+			if (response.first && !response.second.state.empty()) {
 				parseCmdFromServer(response.second);
 			}
 			updateTimestampOnVPT(device->second, ACTION::READ);
@@ -276,7 +276,9 @@ void VPTSensor::run(){
 		deleteDevices(delete_devices);
 		next_wakeup = nextWakeup();
 
-		for (unsigned int i = 0; i < next_wakeup; i++) {
+		// Polling is slowed down while the Aggregator cannot keep up
+		unsigned int interval = agg->scaleInterval(next_wakeup);
+		for (unsigned int i = 0; i < interval; i++) {
 			if (quit_global_flag)
 				break;
 			sleep(1);
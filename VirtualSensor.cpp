@@ -203,14 +203,29 @@ void VirtualSensor::run() {
 
 	while(!quit_global_flag) {
 		log.information("Sending MSG from " + toStringFromLongHex(sensor.euid) + " in time " + toStringFromLongInt(time(0)) + ", sleep for next " + toStringFromInt(wake_up_time) + "s.");
-		pair<bool, Command> response = agg->sendData(createMsg());
-		if (response.first)
-			parseCmdFromServer(response.second);
-
-		for (unsigned int i = 0; i < wake_up_time; i++) {
+		future<pair<bool, Command>> response = agg->sendDataAsync(createMsg());
+		auto processResponse = [&]() {
+			pair<bool, Command> answer = response.get();
+			if (answer.first)
+				parseCmdFromServer(answer.second);
+		};
+
+		// Sending is slowed down while the Aggregator cannot keep up
+		unsigned int interval = agg->scaleInterval(wake_up_time);
+		for (unsigned int i = 0; i < interval; i++) {
 			if (quit_global_flag)
 				break;
 			sleep(1);
+
+			// Response of the server is processed as soon as it comes
+			if (response.valid() && response.wait_for(chrono::seconds(0)) == future_status::ready)
+				processResponse();
+		}
+
+		// Response which did not come during the sleep is waited for before the next message
+		while (response.valid() && !quit_global_flag) {
+			if (response.wait_for(chrono::seconds(1)) == future_status::ready)
+				processResponse();
 		}
 	}
 	actuator_requests_thread->join();
@@ -10,6 +10,7 @@
 #include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/HTTPSClientSession.h>
 #include <Poco/Net/NetException.h>
+#include <Poco/Net/SSLManager.h>
 #include <Poco/ScopedLock.h>
 #include <Poco/Timespan.h>
 
@@ -21,8 +22,6 @@
 #define MAX_WAIT_FOR_RESPONSE_TIME 10
 #define RETRY_WAIT_TIME 1
 
-#define RECEIVE_BUFFER_SIZE 4096
-
 #define TIME_TO_ANSWER 1
 
 using namespace std;
@@ -64,7 +63,8 @@ void WebSocketServerConnection::initConnection()
 
 bool WebSocketServerConnection::initSocket()
 {
-	HTTPSClientSession cs(m_host, m_port);
+	Context::Ptr context = SSLManager::instance().defaultClientContext();
+	HTTPSClientSession cs(m_host, m_port, context, context->sessionCacheEnabled() ? m_tlsSession : Session::Ptr());
 	HTTPRequest request(HTTPRequest::HTTP_GET, m_uri, HTTPMessage::HTTP_1_1);
 	HTTPResponse response;
 
@@ -74,6 +74,7 @@ bool WebSocketServerConnection::initSocket()
 	log.debug("Uri:" + m_uri);
 
 	m_socket.reset();
+	m_frames.clear();
 	try {
 		m_socket.reset(new WebSocket(cs, request, response));
 	}
@@ -82,6 +83,10 @@ bool WebSocketServerConnection::initSocket()
 		return false;
 	}
 
+	// TLS session is kept, so reconnection does not need a full handshake
+	if (context->sessionCacheEnabled())
+		m_tlsSession = cs.sslSession();
+
 	m_socket->setReceiveTimeout(Poco::Timespan(m_socketTimeout, 0));
 	m_socket->setBlocking(true);
 	return true;
@@ -183,35 +188,31 @@ bool WebSocketServerConnection::sendStringToServer(string message)
 
 vector<string> WebSocketServerConnection::receiveMessagesFromServer()
 {
-	char buffer[RECEIVE_BUFFER_SIZE + 1];
 	int bytes_received;
 	vector<string> result_vector;
-	int last_string = 0;
-
-	bytes_received = m_socket->receiveBytes(buffer, RECEIVE_BUFFER_SIZE);
-	buffer[bytes_received] = '\0';
 
-	for (int i = 0; i < bytes_received; i++) {
-		if (buffer[i] == '\0') {
-			result_vector.push_back(m_data_leftover +
-					string(buffer + last_string));
-			m_data_leftover = "";
-			last_string = i + 1;
-		}
-	}
-	m_data_leftover = string(buffer + last_string);
+	// Frame has to be read at once, free space of the ring buffer can be too small for it
+	if (m_receive_buffer.empty())
+		m_receive_buffer.resize(FRAME_MAX_SIZE);
+	char *data = m_receive_buffer.data();
 
+	bytes_received = m_socket->receiveBytes(data, m_receive_buffer.size());
 	if (bytes_received < 1)
 		throw Poco::Net::NoMessageException("");
 
-	log.debug("received packet of " + to_string(bytes_received) + " Bytes, packet content: " + string(buffer));
+	log.debug("received packet of " + to_string(bytes_received) + " Bytes, packet content: " + string(data, bytes_received));
+
+	unsigned int dropped = m_frames.feed(data, bytes_received, [&result_vector](const char *frame, size_t length) {
+		result_vector.push_back(string(frame, length));
+	});
+	if (dropped > 0)
+		log.warning("Dropped " + to_string(dropped) + " messages from server longer than " + to_string(FRAME_MAX_SIZE) + " bytes.");
 
 	return result_vector;
 }
 
 std::pair<bool, Command> WebSocketServerConnection::sendToServer(IOTMessage msg)
 {
-	std::pair<bool, Command> answer(false, Command());
 	ServerMessage sMessage = ServerMessage(msg);
 	request_id_t request_id = generateRequestId();
 
@@ -224,6 +225,33 @@ std::pair<bool, Command> WebSocketServerConnection::sendToServer(IOTMessage msg)
 	else
 		message_to_server = xml.createXML(A_TO_S);
 
+	return sendRequestToServer(request_id, message_to_server);
+}
+
+std::pair<bool, Command> WebSocketServerConnection::sendBatchToServer(const vector<IOTMessage> &batch)
+{
+	ServerMessage sMessage = ServerMessage(batch.front());
+	request_id_t request_id = generateRequestId();
+
+	sMessage.request_id = request_id;
+	sMessage.iotmessage.state = "data";
+	sMessage.iotmessage.time = time(NULL);
+	XMLTool xml(sMessage);
+
+	// Response of the batch can carry a command like responses of TCP connection
+	std::pair<bool, Command> answer = sendRequestToServer(request_id, xml.createBatchXML(batch));
+	if (answer.first)
+		m_agg->parseCmd(answer.second);
+	return answer;
+}
+
+/**
+ * Send request to server and wait for the response with matching response_id.
+ */
+std::pair<bool, Command> WebSocketServerConnection::sendRequestToServer(request_id_t request_id, const string &message_to_server)
+{
+	std::pair<bool, Command> answer(false, Command());
+
 	prepareForResponse(request_id);
 
 	if (!safeSendToServer(message_to_server)) {
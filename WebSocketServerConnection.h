@@ -16,10 +16,12 @@ extern bool quit_global_flag;
 
 #include <Poco/Logger.h>
 #include <Poco/Mutex.h>
+#include <Poco/Net/Session.h>
 #include <Poco/Net/WebSocket.h>
 #include <Poco/Util/IniFileConfiguration.h>
 
 #include "Aggregator.h"
+#include "FrameParser.h"
 #include "ServerConnector.h"
 
 class WebSocketServerConnection : public ServerConnector {
@@ -28,6 +30,7 @@ public:
 			Poco::Util::IniFileConfiguration *cfg, IOTMessage _msg);
 	void run();
 	std::pair<bool, Command> sendToServer(IOTMessage _msg);
+	std::pair<bool, Command> sendBatchToServer(const std::vector<IOTMessage> &batch);
 
 private:
 	void requestDone(request_id_t request_id);
@@ -40,6 +43,7 @@ private:
 	unsigned int generateRequestId();
 
 	//sendToServer subroutines
+	std::pair<bool, Command> sendRequestToServer(request_id_t request_id, const std::string &message_to_server);
 	void prepareForResponse(request_id_t request_id);
 	bool safeSendToServer(std::string message);
 	void checkForResponse(request_id_t request_id, std::pair<bool, Command> &answer);
@@ -50,7 +54,8 @@ private:
 	void sendAckToServer(request_id_t response);
 	bool isConnected();
 	std::unique_ptr<Poco::Net::WebSocket> m_socket;
-	std::string m_data_leftover;
+	FrameParser m_frames;    // messages received from the server
+	std::vector<char> m_receive_buffer;    // one received frame, copied to m_frames
 
 	ServerMessage m_msg;
 
@@ -59,6 +64,7 @@ private:
 	std::string m_host;
 	int m_port;
 	int m_socketTimeout;
+	Poco::Net::Session::Ptr m_tlsSession;    // resumed by the next connection to the server
 
 	bool m_initialized;
 
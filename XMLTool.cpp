@@ -48,19 +48,18 @@ string XMLTool::createXML(int type) {
 		AttributesImpl attrs;
 		writer.startDocument();
 
-		attrs.addAttribute("", "", "adapter_id", "", msg.iotmessage.adapter_id); // TODO!! remove
-		attrs.addAttribute("", "", "state", "", msg.iotmessage.state);
-		attrs.addAttribute("", "", "protocol_version", "", msg.iotmessage.protocol_version);
-		attrs.addAttribute("", "", "fw_version", "", msg.iotmessage.fw_version);
-		attrs.addAttribute("", "", "time", "", toStringFromLongInt(msg.iotmessage.time));
-		if (msg.request_id != 0)
-			attrs.addAttribute("", "", "request_id", "", toStringFromLongInt(msg.request_id));
-		if (msg.response_id != 0)
-			attrs.addAttribute("", "", "response_id", "", toStringFromLongInt(msg.response_id));
+		createHeader(attrs);
 		writer.startElement("", "adapter_server", "", attrs);
 
 		if (type == A_TO_S) {
-			createDevice(&writer, msg.iotmessage.device);  // TODO add fw_version etc?
+			AttributesImpl att;
+			if (msg.iotmessage.seq != 0)
+				att.addAttribute("", "", "seq", "", to_string(msg.iotmessage.seq));
+
+			if (!msg.iotmessage.wire.empty())
+				writeDeviceWire(&writer, msg.iotmessage.wire, att);
+			else
+				createDevice(&writer, msg.iotmessage.device, att);  // TODO add fw_version etc?
 		}
 		else if (type == INIT) {
 			writer.characters(" ");
@@ -78,16 +77,114 @@ string XMLTool::createXML(int type) {
 	 return stream.str();
 }
 
+/**
+ * Create message with more devices which can be sent to server in one request.
+ * Every <device> element carries its own timestamp, index and sequence number, the server
+ * acknowledges processed devices by <ack index="..."/> or <ack seq="..."/> elements.
+ * @param batch Messages to send, header of the envelope is taken from the message given in constructor
+ * @return Created message in string
+ */
+string XMLTool::createBatchXML(const vector<IOTMessage> &batch) {
+	stringstream stream;
+	Poco::UTF8Encoding utf8;
+
+	try {
+		XMLWriter writer(stream, XMLWriter::WRITE_XML_DECLARATION | XMLWriter::PRETTY_PRINT, "UTF-8", &utf8);
+		writer.setNewLine("\n");
+		AttributesImpl attrs;
+		writer.startDocument();
+
+		createHeader(attrs);
+		attrs.addAttribute("", "", "count", "", toStringFromInt(batch.size()));
+		writer.startElement("", "adapter_server", "", attrs);
+
+		for (unsigned int i = 0; i < batch.size(); i++) {
+			AttributesImpl att;
+			att.addAttribute("", "", "index", "", toStringFromInt(i));
+			att.addAttribute("", "", "time", "", toStringFromLongInt(batch[i].time));
+			if (batch[i].seq != 0)
+				att.addAttribute("", "", "seq", "", to_string(batch[i].seq));
+			if (!batch[i].wire.empty())
+				writeDeviceWire(&writer, batch[i].wire, att);
+			else
+				createDevice(&writer, batch[i].device, att);
+		}
+
+		writer.endElement("", "adapter_server", "");
+		writer.endDocument();
+	}
+	catch (Poco::Exception& ex) {
+		log.error("*** Exception: \n" + ex.displayText());
+	}
+	return stream.str();
+}
+
+/**
+ * Serialize the <device> element once, so the message can be sent again without
+ * building of the XML. The time of message is not part of the element, it is
+ * added by createXML() and createBatchXML() when the message is sent.
+ * @param dev Device data
+ * @return Element without its leading "<device", empty string on error
+ */
+string XMLTool::createDeviceWire(const Device &dev) {
+	stringstream stream;
+	Poco::UTF8Encoding utf8;
+
+	try {
+		XMLWriter writer(stream, 0, "UTF-8", &utf8);
+		writer.startFragment();
+		createDevice(&writer, dev);
+		writer.endFragment();
+	}
+	catch (Poco::Exception& ex) {
+		log.error("*** Exception: \n" + ex.displayText());
+		return "";
+	}
+
+	string wire = stream.str();
+	return wire.compare(0, 7, "<device") == 0 ? wire.substr(7) : "";
+}
+
+/**
+ * Internal function for writing the <device> element serialized by createDeviceWire()
+ * @param w Pointer to XMLWriter
+ * @param wire Serialized element
+ * @param att Attributes preceding the serialized ones (index, time)
+ */
+void XMLTool::writeDeviceWire(XMLWriter* w, const string &wire, AttributesImpl att) {
+	string element = "<device";
+
+	for (int i = 0; i < att.getLength(); i++)
+		element += " " + att.getLocalName(i) + "=\"" + att.getValue(i) + "\"";
+	w->rawCharacters(element + wire);
+}
+
+/**
+ * Internal function for filling attributes of the <adapter_server> element
+ * @param attrs Attributes of the element
+ */
+void XMLTool::createHeader(AttributesImpl &attrs) {
+	attrs.addAttribute("", "", "adapter_id", "", msg.iotmessage.adapter_id); // TODO!! remove
+	attrs.addAttribute("", "", "state", "", msg.iotmessage.state);
+	attrs.addAttribute("", "", "protocol_version", "", msg.iotmessage.protocol_version);
+	attrs.addAttribute("", "", "fw_version", "", msg.iotmessage.fw_version);
+	attrs.addAttribute("", "", "time", "", toStringFromLongInt(msg.iotmessage.time));
+	if (msg.request_id != 0)
+		attrs.addAttribute("", "", "request_id", "", toStringFromLongInt(msg.request_id));
+	if (msg.response_id != 0)
+		attrs.addAttribute("", "", "response_id", "", toStringFromLongInt(msg.response_id));
+}
+
 /**
  * Internal function for creating the <device> element filled with values
  * @param w Pointer to XMLWriter
  * @param dev Device data
+ * @param att Additional attributes of the element
  * @param debug Flag - add debug mark
  * @param proto Communication protocol version
  * @param fw Firmware version of device
  */
-void XMLTool::createDevice(XMLWriter* w, Device dev, bool debug, string proto, string fw) {
-	AttributesImpl att;
+void XMLTool::createDevice(XMLWriter* w, Device dev, AttributesImpl att, bool debug, string proto, string fw) {
 	att.addAttribute("", "", "euid", "", toStringFromLongHex(dev.euid));
 	att.addAttribute("", "", "device_id", "", toStringFromLongHex(dev.device_id, 2));
 	if(dev.name != ""){
@@ -187,6 +284,14 @@ ServerCommand XMLTool::parseXML(string str) {
 							cmd.command.time = atoll(attribute->nodeValue().c_str());
 						}
 
+						else if (attribute->nodeName().compare("drain_rate") == 0) {
+							cmd.command.drain_rate = toIntFromString(attribute->nodeValue());
+						}
+
+						else if (attribute->nodeName().compare("drain_burst") == 0) {
+							cmd.command.drain_burst = toIntFromString(attribute->nodeValue());
+						}
+
 						else {
 							log.error("Unknow attribute for SERVER_ADAPTER : " + fromXMLString(attribute->nodeName()));
 						}
@@ -236,6 +341,24 @@ ServerCommand XMLTool::parseXML(string str) {
 					}
 				}
 			}
+			else if (pNode->nodeName().compare("ack") == 0) {
+				if (pNode->hasAttributes()) {
+					attributes = pNode->attributes();
+					for(unsigned int i = 0; i < attributes->length(); i++) {
+						attribute = attributes->item(i);
+						if (attribute->nodeName().compare("index") == 0) {
+							cmd.command.acks.push_back(toIntFromString(attribute->nodeValue()));
+						}
+						else if (attribute->nodeName().compare("seq") == 0) {
+							// Invalid sequence number (or 0 = none) does not acknowledge anything
+							long long int seq = toIntFromString(attribute->nodeValue());
+							if (seq > 0)
+								cmd.command.acked_seqs.push_back(seq);
+						}
+					}
+					attributes->release();
+				}
+			}
 			else if (pNode->nodeName().compare("parameter") == 0) {
 				if (pNode->hasAttributes()) {
 					attributes = pNode->attributes();
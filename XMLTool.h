@@ -10,6 +10,7 @@
 
 #include <fstream>
 #include <tuple>
+#include <vector>
 
 #include <Poco/AutoPtr.h>
 #include <Poco/DOM/AutoPtr.h>
@@ -35,12 +36,16 @@ public:
 	XMLTool();
 	XMLTool(ServerMessage);
 	std::string createXML(int);
+	std::string createBatchXML(const std::vector<IOTMessage> &batch);
+	std::string createDeviceWire(const Device &dev);
 	ServerCommand parseXML(std::string);
 	virtual ~XMLTool();
 
 private:
 	ServerMessage msg;
-	void createDevice(Poco::XML::XMLWriter*, Device, bool debug=false, std::string proto="", std::string fw="");
+	void createDevice(Poco::XML::XMLWriter*, Device, Poco::XML::AttributesImpl att=Poco::XML::AttributesImpl(), bool debug=false, std::string proto="", std::string fw="");
+	void createHeader(Poco::XML::AttributesImpl &attrs);
+	void writeDeviceWire(Poco::XML::XMLWriter* w, const std::string &wire, Poco::XML::AttributesImpl att=Poco::XML::AttributesImpl());
 	void createParam(Poco::XML::XMLWriter* w, CmdParam dev, std::string state);
 	Poco::Logger& log;
 };
@@ -215,6 +215,8 @@ int main (int, char**) {
 	Context::Ptr pContext = NULL;
 	try {
 		pContext = new Context(Context::CLIENT_USE, cfg->getString("ssl.key", ""), cfg->getString("ssl.certificate", ""), cfg->getString("ssl.calocation", "./"), (Context::VerificationMode) cfg->getInt("ssl.verify_level", Context::VERIFY_RELAXED), 9, false, "ALL:ADH:!LOW:!EXP:!MD5:@STRENGTH");
+		// Sessions are resumed by the connections to the server, so reconnection does not need a full handshake
+		pContext->enableSessionCache(cfg->getBool("ssl.session_cache", true));
 	} catch (Poco::Exception& ex) {
 		log.fatal("Creating SSL failed! Please check cerficate file and configuration! (" + (string)ex.displayText() + ")");
 		return (EXIT_FAILURE);
@@ -263,6 +265,7 @@ int main (int, char**) {
 		else {
 			shared_ptr<IOTReceiver> iOTReceiver (new IOTReceiver(agg, IP_addr_out, port_out, msg, adapter_id));
 			iOTReceiver->keepaliveInit(cfg);
+			iOTReceiver->connectionPoolInit(cfg);
 			connection = iOTReceiver;
 		}
 
@@ -373,6 +376,7 @@ int main (int, char**) {
 		}
 
 		log.information("Stopping modules...");
+		connection->stop();
 
 		if (mod_virtual_sensor) {
 			log.information("Stopping Virtual Sensor module...");
@@ -418,6 +422,7 @@ int main (int, char**) {
 		srv_thread.join();
 
 		log.information("Stopping aggregator...");
+		agg->stop();
 		agg_thread.join();
 
 		uninitializeSSL();
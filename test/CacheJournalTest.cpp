@@ -0,0 +1,148 @@
+/**
+ * @file CacheJournalTest.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Replay of the cache journal after compaction
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+
+#include <unistd.h>
+
+#include <Poco/File.h>
+#include <Poco/Thread.h>
+
+#include "CacheJournal.h"
+
+using namespace std;
+
+bool quit_global_flag = false;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; \
+			failures++; \
+		} \
+	} while (0)
+
+static IOTMessage createMessage(long long int time) {
+	IOTMessage msg;
+
+	msg.state = "data";
+	msg.adapter_id = "1234";
+	msg.time = time;
+	msg.valid = true;
+	msg.device.euid = 0x1000 + time;
+	msg.device.name = "sensor-" + to_string(time);
+	return msg;
+}
+
+/**
+ * Run the journal thread until queued records are written and sealed segments compacted.
+ */
+static void runJournal(CacheJournal &journal) {
+	Poco::Thread thread;
+
+	quit_global_flag = false;
+	thread.start(journal);
+	Poco::Thread::sleep(200);
+	quit_global_flag = true;
+	thread.join();
+}
+
+/**
+ * Messages which stay live in the compacted segment follow its base and seq records,
+ * all of them must be loaded again after restart.
+ */
+static void testReplayAfterCompaction(const string &path) {
+	set<uint64_t> live;
+	uint64_t last_id = 0;
+
+	{
+		// Every record seals a segment, compaction is started for any sealed segment
+		CacheJournal journal(path, 16, 0, 10);
+
+		for (long long int time = 1; time <= 20; time++) {
+			uint64_t id = journal.append(createMessage(time));
+			if (time % 2 == 0)
+				journal.remove(id);
+			else
+				live.insert(id);
+			last_id = id;
+		}
+		runJournal(journal);
+	}
+
+	{
+		CacheJournal journal(path, 16, 0, 10);
+		vector<Cache_Item> items = journal.recovered();
+
+		CHECK(items.size() == live.size());
+		for (const Cache_Item &item : items) {
+			CHECK(live.count(item.id) == 1);
+			CHECK(item.msg.time == static_cast<long long int>(item.id));
+			CHECK(item.msg.device.name == "sensor-" + to_string(item.id));
+		}
+
+		// Identifiers are not reused after restart
+		uint64_t id = journal.allocateId();
+		CHECK(id > last_id);
+		last_id = id;
+
+		for (const Cache_Item &item : items)
+			journal.remove(item.id);
+		runJournal(journal);
+	}
+
+	{
+		// All segments were removed, only the sequence number is left
+		CacheJournal journal(path, 16, 0, 10);
+
+		CHECK(journal.recovered().empty());
+		CHECK(journal.allocateId() > last_id);
+	}
+}
+
+/**
+ * Identifiers taken faster than the journal thread reserves them are not reused
+ * after restart.
+ */
+static void testIdsBeyondReservedBlock(const string &path) {
+	uint64_t last_id = 0;
+
+	{
+		CacheJournal journal(path, 1024 * 1024, 0, 10);
+
+		for (unsigned int i = 0; i < 3 * JOURNAL_ID_BLOCK; i++)
+			last_id = journal.allocateId();
+	}
+
+	{
+		CacheJournal journal(path, 1024 * 1024, 0, 10);
+		CHECK(journal.allocateId() > last_id);
+	}
+}
+
+int main() {
+	char dir[] = "/tmp/adaapp-journal-XXXXXX";
+
+	if (mkdtemp(dir) == NULL) {
+		cerr << "Cannot create temporary directory" << endl;
+		return EXIT_FAILURE;
+	}
+
+	testReplayAfterCompaction(string(dir) + "/journal");
+	testIdsBeyondReservedBlock(string(dir) + "/ids");
+	Poco::File(dir).remove(true);
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
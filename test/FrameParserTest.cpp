@@ -0,0 +1,108 @@
+/**
+ * @file FrameParserTest.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Extraction of delimited messages from a stream of the server
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FrameParser.h"
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; \
+			failures++; \
+		} \
+	} while (0)
+
+static string frame(const char *data, size_t length) {
+	return string(data, length);
+}
+
+/**
+ * Data received directly to the free space are split by the wrap of the buffer.
+ */
+static void testReceiveAcrossWrap() {
+	FrameParser frames(15);
+	vector<string> messages;
+	auto collect = [&messages](const char *data, size_t length) { messages.push_back(frame(data, length)); };
+	const string stream = string("first-msg") + '\0' + "second" + '\0' + "third-one" + '\0';
+
+	// Receive in chunks limited by the contiguous free space
+	size_t pos = 0;
+	while (pos < stream.length()) {
+		char *data;
+		size_t space = frames.space(data);
+		size_t chunk = min<size_t>(space, min<size_t>(4, stream.length() - pos));
+
+		CHECK(space > 0);
+		stream.copy(data, chunk, pos);
+		frames.commit(chunk);
+		pos += chunk;
+		CHECK(frames.extract(collect) == 0);
+	}
+
+	CHECK(messages.size() == 3);
+	CHECK(messages.size() > 2 && messages[0] == "first-msg" && messages[1] == "second" && messages[2] == "third-one");
+	CHECK(frames.size() == 0);
+}
+
+/**
+ * Frame copied by feed() is not truncated by the free space left before the wrap.
+ */
+static void testFeedAcrossWrap() {
+	FrameParser frames(15);
+	vector<string> messages;
+	auto collect = [&messages](const char *data, size_t length) { messages.push_back(frame(data, length)); };
+
+	// The unfinished message "abcdef" wraps around the end of the buffer
+	string first = string("0123456789") + '\0' + "abcdef";
+	CHECK(frames.feed(first.data(), first.length(), collect) == 0);
+	CHECK(frames.size() == 6);
+
+	// Received data are larger than the contiguous free space
+	string second = string("ghij") + '\0' + "klmnopq" + '\0';
+	char *data;
+	CHECK(frames.space(data) < second.length());
+
+	CHECK(frames.feed(second.data(), second.length(), collect) == 0);
+
+	CHECK(messages.size() == 3);
+	CHECK(messages.size() > 2 && messages[0] == "0123456789" && messages[1] == "abcdefghij" && messages[2] == "klmnopq");
+	CHECK(frames.size() == 0);
+}
+
+/**
+ * Message longer than the buffer is dropped up to its delimiter, the next one is kept.
+ */
+static void testDropLongMessage() {
+	FrameParser frames(8);
+	vector<string> messages;
+	auto collect = [&messages](const char *data, size_t length) { messages.push_back(frame(data, length)); };
+
+	string stream = string(30, 'x') + '\0' + "short" + '\0';
+	CHECK(frames.feed(stream.data(), stream.length(), collect) == 1);
+	CHECK(messages.size() == 1);
+	CHECK(!messages.empty() && messages[0] == "short");
+}
+
+int main() {
+	testReceiveAcrossWrap();
+	testFeedAcrossWrap();
+	testDropLongMessage();
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file MessageCacheTest.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Lanes, coalescing, expiration and eviction of cached messages
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "MessageCache.h"
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; \
+			failures++; \
+		} \
+	} while (0)
+
+static Cache_Item createItem(uint64_t id, MSG_PRIO priority, long long int time, const vector<Value> &values, euid_t euid = 0xa1000001) {
+	IOTMessage msg;
+
+	msg.state = "data";
+	msg.adapter_id = "1234";
+	msg.priority = priority;
+	msg.valid = true;
+	msg.time = time;
+	msg.device.euid = euid;
+	msg.device.device_id = 0;
+	msg.device.values = values;
+	msg.device.pairs = values.size();
+	return Cache_Item(id, msg);
+}
+
+static Cache_Item createReading(uint64_t id, MSG_PRIO priority, long long int time) {
+	return createItem(id, priority, time, {Value(0, 21.5)});
+}
+
+static bool contains(const vector<Cache_Item> &items, uint64_t id) {
+	for (const Cache_Item &item : items) {
+		if (item.id == id)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Without lanes the messages are taken by priority, the oldest one first.
+ */
+static void testStrictPriority() {
+	MessageCache cache;
+	Cache_Item item;
+
+	cache.insert(createReading(1, MSG_PRIO_HISTORY, 10));
+	cache.insert(createReading(2, MSG_PRIO_SENSOR, 30));
+	cache.insert(createReading(3, MSG_PRIO_SENSOR, 20));
+	cache.insert(createReading(4, MSG_PRIO_ACTUATOR, 40));
+
+	const uint64_t order[] = {4, 3, 2, 1};
+	for (uint64_t id : order) {
+		CHECK(cache.pop(item));
+		CHECK(item.id == id);
+	}
+	CHECK(!cache.pop(item));
+	CHECK(cache.memoryUsage() == 0);
+}
+
+/**
+ * Lanes of the same weight are served alternately, priority without a lane goes first.
+ */
+static void testLanes() {
+	MessageCache cache;
+	Cache_Item item;
+
+	cache.setLane(MSG_PRIO_HISTORY, 1, LANE_OLDEST_FIRST);
+	cache.setLane(MSG_PRIO_SENSOR, 1, LANE_NEWEST_FIRST);
+
+	for (long long int time = 1; time <= 3; time++) {
+		cache.insert(createReading(time, MSG_PRIO_HISTORY, time));
+		cache.insert(createReading(10 + time, MSG_PRIO_SENSOR, 10 + time));
+	}
+	cache.insert(createReading(100, MSG_PRIO_ACTUATOR, 100));
+
+	// History from the oldest message, sensor readings from the newest one
+	const uint64_t order[] = {100, 13, 1, 12, 2, 11, 3};
+	for (uint64_t id : order) {
+		CHECK(cache.pop(item));
+		CHECK(item.id == id);
+	}
+	CHECK(!cache.pop(item));
+}
+
+/**
+ * Value of sensor module is dropped within the resolution, value of actuator replaces
+ * the cached one within the window.
+ */
+static void testCoalescing() {
+	MessageCache cache;
+	vector<Cache_Item> updated;
+	vector<Cache_Item> removed;
+
+	cache.setCoalescing(60, 10);
+
+	Cache_Item first = createReading(1, MSG_PRIO_SENSOR, 100);
+	CHECK(cache.coalesce(first, updated, removed));
+	cache.insert(first);
+
+	Cache_Item close = createReading(2, MSG_PRIO_SENSOR, 105);
+	CHECK(!cache.coalesce(close, updated, removed));
+
+	Cache_Item later = createReading(3, MSG_PRIO_SENSOR, 112);
+	CHECK(cache.coalesce(later, updated, removed));
+	cache.insert(later);
+
+	Cache_Item set = createItem(4, MSG_PRIO_ACTUATOR, 100, {Value(5, 1)});
+	CHECK(cache.coalesce(set, updated, removed));
+	cache.insert(set);
+
+	Cache_Item reset = createItem(5, MSG_PRIO_ACTUATOR, 130, {Value(5, 0)});
+	CHECK(cache.coalesce(reset, updated, removed));
+	cache.insert(reset);
+
+	CHECK(updated.empty());
+	CHECK(removed.size() == 1);
+	CHECK(contains(removed, 4));
+	CHECK(cache.size() == 3);
+
+	// Only the actuator value is taken from the cached message with both modules
+	updated.clear();
+	removed.clear();
+	Cache_Item both = createItem(6, MSG_PRIO_ACTUATOR, 135, {Value(0, 22), Value(5, 1)});
+	CHECK(cache.coalesce(both, updated, removed));
+	cache.insert(both);
+
+	Cache_Item again = createItem(7, MSG_PRIO_ACTUATOR, 140, {Value(0, 23), Value(5, 0)});
+	CHECK(cache.coalesce(again, updated, removed));
+	CHECK(again.msg.device.values.size() == 1);
+	CHECK(again.msg.device.pairs == 1);
+	CHECK(contains(removed, 5));
+	CHECK(contains(updated, 6));
+}
+
+/**
+ * Values are removed after TTL of their module or device, messages of unresolved
+ * blackout are kept.
+ */
+static void testExpire() {
+	MessageCache cache;
+	vector<Cache_Item> updated;
+	vector<Cache_Item> removed;
+
+	cache.setTTL(0, 60);
+	cache.setTTL(0, 1, 10);
+	cache.insert(createItem(1, MSG_PRIO_SENSOR, 1000, {Value(0, 21.5), Value(1, 40)}));
+
+	Cache_Item blackout = createReading(2, MSG_PRIO_SENSOR, 0);
+	blackout.msg.valid = false;
+	blackout.msg.offset = 0;
+	cache.insert(blackout);
+
+	cache.expire(1005, updated, removed);
+	CHECK(updated.empty() && removed.empty());
+
+	cache.expire(1020, updated, removed);
+	CHECK(removed.empty());
+	CHECK(updated.size() == 1);
+	CHECK(!updated.empty() && updated[0].id == 1 && updated[0].msg.device.values.size() == 1);
+
+	updated.clear();
+	cache.expire(1070, updated, removed);
+	CHECK(updated.empty());
+	CHECK(removed.size() == 1 && contains(removed, 1));
+	CHECK(cache.size() == 1);
+
+	// Age of the blackout messages is known after its beginning is set
+	removed.clear();
+	cache.resolveBlackout(1000);
+	cache.expire(1070, updated, removed);
+	CHECK(removed.size() == 1 && contains(removed, 2));
+	CHECK(cache.empty());
+	CHECK(cache.memoryUsage() == 0);
+}
+
+/**
+ * History is evicted first, the oldest messages at first.
+ */
+static void testEvictHistory() {
+	MessageCache cache;
+
+	for (long long int time = 1; time <= 10; time++)
+		cache.insert(createReading(time, MSG_PRIO_HISTORY, time));
+	size_t history = cache.memoryUsage();
+
+	for (long long int time = 11; time <= 20; time++)
+		cache.insert(createReading(time, MSG_PRIO_SENSOR, time));
+	cache.insert(createItem(100, MSG_PRIO_ACTUATOR, 5, {Value(5, 1)}));
+
+	cache.setBudget(cache.memoryUsage() - history / 2);
+	vector<Cache_Item> evicted = cache.evict();
+
+	CHECK(evicted.size() == 5);
+	for (const Cache_Item &item : evicted)
+		CHECK(item.msg.priority == MSG_PRIO_HISTORY && item.id <= 5);
+	CHECK(cache.memoryUsage() <= cache.getBudget());
+	CHECK(cache.size() == 16);
+
+	// Nothing is evicted within the budget
+	CHECK(cache.evict().empty());
+}
+
+/**
+ * Sensor readings are thinned out with a growing resolution, the oldest readings
+ * the most. The other messages and the oldest reading are kept.
+ */
+static void testThinOut() {
+	MessageCache cache;
+
+	for (long long int time = 0; time < 100; time++)
+		cache.insert(createReading(time + 1, MSG_PRIO_SENSOR, time));
+	cache.insert(createItem(1000, MSG_PRIO_ACTUATOR, 0, {Value(5, 1)}));
+	cache.insert(createItem(1001, MSG_PRIO_REG, 0, {}));
+
+	cache.setBudget(cache.memoryUsage() / 3);
+	vector<Cache_Item> evicted = cache.evict();
+
+	CHECK(!evicted.empty());
+	CHECK(cache.memoryUsage() <= cache.getBudget());
+	CHECK(!contains(evicted, 1000) && !contains(evicted, 1001));
+	CHECK(!contains(evicted, 1));
+
+	vector<long long int> kept;
+	cache.forEach([&kept](const Cache_Item &item) {
+		if (item.msg.priority == MSG_PRIO_SENSOR)
+			kept.push_back(item.msg.time);
+	});
+	CHECK(kept.size() + evicted.size() == 100);
+	CHECK(kept.size() > 2 && kept.back() >= 98);
+
+	// Readings are spread over the whole outage, older ones are not denser than newer ones
+	for (size_t i = 1; i < kept.size(); i++) {
+		CHECK(kept[i] - kept[i - 1] > 1);
+		CHECK(i == 1 || kept[i] - kept[i - 1] <= kept[i - 1] - kept[i - 2]);
+	}
+}
+
+int main() {
+	testStrictPriority();
+	testLanes();
+	testCoalescing();
+	testExpire();
+	testEvictHistory();
+	testThinOut();
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file ReadingSeriesTest.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Compressed readings of one device in the message cache
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "ReadingSeries.h"
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; \
+			failures++; \
+		} \
+	} while (0)
+
+static IOTMessage createReading(long long int time, uint64_t seq, float temperature, float humidity) {
+	IOTMessage msg;
+
+	msg.state = "data";
+	msg.adapter_id = "1234";
+	msg.priority = MSG_PRIO_SENSOR;
+	msg.valid = true;
+	msg.time = time;
+	msg.seq = seq;
+	msg.device.euid = 0xa1000001;
+	msg.device.device_id = 0;
+	msg.device.values = {Value(0, temperature), Value(2, humidity, false)};
+	msg.device.pairs = msg.device.values.size();
+	return msg;
+}
+
+static bool sameReading(const IOTMessage &a, const IOTMessage &b) {
+	if (a.time != b.time || a.seq != b.seq || a.device.euid != b.device.euid
+			|| a.adapter_id != b.adapter_id || a.device.values.size() != b.device.values.size())
+		return false;
+
+	for (unsigned int i = 0; i < a.device.values.size(); i++) {
+		const Value &x = a.device.values[i];
+		const Value &y = b.device.values[i];
+		if (x.mid != y.mid || x.value != y.value || x.status != y.status)
+			return false;
+	}
+	return true;
+}
+
+static vector<IOTMessage> createReadings(unsigned int count) {
+	vector<IOTMessage> readings;
+	long long int time = 1500000000;
+
+	for (unsigned int i = 0; i < count; i++) {
+		time += 60 + (i % 7 == 0 ? 13 : 0) - (i % 5 == 0 ? 2 : 0);
+		readings.push_back(createReading(time, 100 + 2 * i, 21.5 + (i % 9) * 0.25, (i % 3 == 0) ? 40 : 41.75));
+	}
+	return readings;
+}
+
+/**
+ * Readings with irregular timestamps and changing values are decoded unchanged,
+ * also across more blocks.
+ */
+static void testRoundTrip() {
+	vector<IOTMessage> readings = createReadings(3 * SERIES_BLOCK_SIZE + 5);
+	ReadingSeries series(readings.front());
+
+	for (const IOTMessage &msg : readings)
+		CHECK(series.append(msg));
+
+	CHECK(series.size() == readings.size());
+	CHECK(series.blockCount() == 4);
+	CHECK(series.firstTime() == readings.front().time);
+	CHECK(series.lastTime() == readings.back().time);
+
+	vector<IOTMessage> decoded = series.decode();
+	CHECK(decoded.size() == readings.size());
+	for (unsigned int i = 0; i < decoded.size() && i < readings.size(); i++)
+		CHECK(sameReading(decoded[i], readings[i]));
+}
+
+/**
+ * Readings are taken from both ends of the series.
+ */
+static void testPop() {
+	vector<IOTMessage> readings = createReadings(SERIES_BLOCK_SIZE + 3);
+	ReadingSeries series(readings.front());
+
+	for (const IOTMessage &msg : readings)
+		series.append(msg);
+
+	CHECK(sameReading(series.popFront(), readings[0]));
+	CHECK(sameReading(series.popFront(), readings[1]));
+	CHECK(sameReading(series.popBack(), readings.back()));
+	CHECK(series.size() == readings.size() - 3);
+	CHECK(series.firstTime() == readings[2].time);
+
+	// The last reading can be appended again after the tail was taken
+	CHECK(series.append(readings.back()));
+	CHECK(sameReading(series.decode().back(), readings.back()));
+
+	while (series.size() > 0)
+		series.popBack();
+	CHECK(series.empty());
+	CHECK(series.blockCount() == 0);
+}
+
+/**
+ * Readings of other device, older readings and messages which cannot be compressed
+ * are not appended.
+ */
+static void testRejected() {
+	IOTMessage first = createReading(1000, 1, 20, 50);
+	ReadingSeries series(first);
+
+	CHECK(series.append(first));
+
+	IOTMessage older = createReading(999, 2, 20, 50);
+	CHECK(!series.append(older));
+
+	IOTMessage other = createReading(1001, 3, 20, 50);
+	other.device.euid++;
+	CHECK(!series.append(other));
+
+	IOTMessage invalid = createReading(1002, 4, 20, 50);
+	invalid.valid = false;
+	CHECK(!ReadingSeries::eligible(invalid));
+	CHECK(!series.append(invalid));
+
+	IOTMessage unsequenced = createReading(1003, 0, 20, 50);
+	CHECK(!ReadingSeries::eligible(unsequenced));
+
+	CHECK(series.size() == 1);
+}
+
+/**
+ * Block is replaced by the kept readings, e.g. when it is thinned out.
+ */
+static void testReplaceBlock() {
+	vector<IOTMessage> readings = createReadings(2 * SERIES_BLOCK_SIZE);
+	ReadingSeries series(readings.front());
+
+	for (const IOTMessage &msg : readings)
+		series.append(msg);
+
+	vector<IOTMessage> block = series.decodeBlock(0);
+	vector<IOTMessage> kept;
+	for (unsigned int i = 0; i < block.size(); i += 2)
+		kept.push_back(block[i]);
+	series.replaceBlock(0, kept);
+
+	CHECK(series.size() == readings.size() - SERIES_BLOCK_SIZE / 2);
+	CHECK(series.blockCount() == 2);
+
+	vector<IOTMessage> decoded = series.decode();
+	CHECK(decoded.size() == series.size());
+	CHECK(!decoded.empty() && sameReading(decoded.front(), readings[0]));
+	CHECK(decoded.size() > 1 && sameReading(decoded[1], readings[2]));
+	CHECK(!decoded.empty() && sameReading(decoded.back(), readings.back()));
+
+	// New readings still follow the last block
+	IOTMessage next = createReading(readings.back().time + 60, 1000, 22, 45);
+	CHECK(series.append(next));
+	CHECK(sameReading(series.decode().back(), next));
+}
+
+int main() {
+	testRoundTrip();
+	testPop();
+	testRejected();
+	testReplaceBlock();
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
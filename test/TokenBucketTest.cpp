@@ -0,0 +1,117 @@
+/**
+ * @file TokenBucketTest.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Pacing of messages sent to the server
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "TokenBucket.h"
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; \
+			failures++; \
+		} \
+	} while (0)
+
+static long long int milliseconds(chrono::steady_clock::duration duration) {
+	return chrono::duration_cast<chrono::milliseconds>(duration).count();
+}
+
+/**
+ * Bucket without rate never delays messages.
+ */
+static void testUnlimited() {
+	TokenBucket bucket;
+
+	for (int i = 0; i < 100; i++)
+		CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+	CHECK(bucket.reserve(1000) == chrono::steady_clock::duration::zero());
+}
+
+/**
+ * Burst is sent at once, the following messages are paced by the rate.
+ */
+static void testRate() {
+	TokenBucket bucket(10, 2);
+
+	CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+	CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+
+	// Every following message waits for one more token (100 ms)
+	long long int first = milliseconds(bucket.reserve(1));
+	long long int second = milliseconds(bucket.reserve(1));
+	CHECK(first > 50 && first <= 100);
+	CHECK(second > 150 && second <= 200);
+}
+
+/**
+ * Tokens of messages which were not sent are returned, never above the burst.
+ */
+static void testRelease() {
+	TokenBucket bucket(1, 1);
+
+	CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+	bucket.release(1);
+	CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+
+	bucket.release(5);
+	CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+	CHECK(milliseconds(bucket.reserve(1)) > 900);
+}
+
+/**
+ * Paused bucket delays messages by the pause and it starts empty.
+ */
+static void testPause() {
+	TokenBucket bucket(10, 5);
+
+	bucket.pause(chrono::milliseconds(500));
+	long long int first = milliseconds(bucket.reserve(1));
+	CHECK(first > 500 && first <= 600);
+
+	TokenBucket unlimited;
+	unlimited.pause(chrono::milliseconds(500));
+	long long int delay = milliseconds(unlimited.reserve(1));
+	CHECK(delay > 400 && delay <= 500);
+}
+
+/**
+ * Change of the rate keeps the reserved tokens, burst is at least one token.
+ */
+static void testSetRate() {
+	TokenBucket bucket(10, 1);
+
+	bucket.setRate(-5, 0);
+	CHECK(bucket.getRate() == 0);
+	CHECK(bucket.getBurst() == 1);
+
+	bucket.setRate(2, 3);
+	CHECK(bucket.getRate() == 2);
+	CHECK(bucket.getBurst() == 3);
+	CHECK(bucket.reserve(1) == chrono::steady_clock::duration::zero());
+	CHECK(milliseconds(bucket.reserve(1)) > 450);
+}
+
+int main() {
+	testUnlimited();
+	testRate();
+	testRelease();
+	testPause();
+	testSetRate();
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
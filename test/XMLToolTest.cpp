@@ -0,0 +1,145 @@
+/**
+ * @file XMLToolTest.cpp
+ * @Author BeeeOn team
+ * @date
+ * @brief Batch messages to the server and parsing of their acknowledgements
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Poco/AutoPtr.h>
+#include <Poco/DOM/Document.h>
+#include <Poco/DOM/DOMParser.h>
+#include <Poco/DOM/Element.h>
+#include <Poco/DOM/NodeList.h>
+
+#include "XMLTool.h"
+
+using namespace std;
+using Poco::AutoPtr;
+using namespace Poco::XML;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; \
+			failures++; \
+		} \
+	} while (0)
+
+static IOTMessage createMessage(long long int time, uint64_t seq, euid_t euid) {
+	IOTMessage msg;
+
+	msg.state = "data";
+	msg.adapter_id = "1234";
+	msg.protocol_version = "1.0";
+	msg.fw_version = "0.1";
+	msg.valid = true;
+	msg.time = time;
+	msg.seq = seq;
+	msg.device.euid = euid;
+	msg.device.device_id = 0;
+	msg.device.values = {Value(0, 21.5), Value(2, 40)};
+	msg.device.pairs = msg.device.values.size();
+	return msg;
+}
+
+/**
+ * Acknowledged indexes and sequence numbers are collected, sequence number 0 or invalid
+ * one does not acknowledge anything.
+ */
+static void testParseAcks() {
+	XMLTool parser;
+	ServerCommand cmd = parser.parseXML(
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<server_adapter protocol_version=\"1.0\" state=\"data\" response_id=\"7\" drain_rate=\"5\" drain_burst=\"20\">\n"
+		"<ack index=\"0\"/>\n"
+		"<ack index=\"2\"/>\n"
+		"<ack seq=\"17\"/>\n"
+		"<ack seq=\"0\"/>\n"
+		"<ack seq=\"x\"/>\n"
+		"</server_adapter>\n");
+
+	CHECK(cmd.command.state == "data");
+	CHECK(cmd.response_id == 7);
+	CHECK(cmd.command.acks == vector<int>({0, 2}));
+	CHECK(cmd.command.acked_seqs == vector<uint64_t>({17}));
+	CHECK(cmd.command.drain_rate == 5);
+	CHECK(cmd.command.drain_burst == 20);
+}
+
+/**
+ * Response without acknowledgements and pacing keeps the defaults.
+ */
+static void testParseWithoutAcks() {
+	XMLTool parser;
+	ServerCommand cmd = parser.parseXML(
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<server_adapter protocol_version=\"1.0\" state=\"data\"/>\n");
+
+	CHECK(cmd.command.state == "data");
+	CHECK(cmd.command.acks.empty());
+	CHECK(cmd.command.acked_seqs.empty());
+	CHECK(cmd.command.drain_rate == -1);
+	CHECK(cmd.command.drain_burst == -1);
+}
+
+/**
+ * Every device of the batch carries its index, time and sequence number, also when
+ * it was serialized before.
+ */
+static void testBatch() {
+	vector<IOTMessage> batch = {
+		createMessage(1000, 5, 0xa1000001),
+		createMessage(1010, 0, 0xa1000002),
+		createMessage(1020, 7, 0xa1000003),
+	};
+	ServerMessage header(batch[0]);
+	XMLTool tool(header);
+
+	batch[2].wire = tool.createDeviceWire(batch[2].device);
+	CHECK(!batch[2].wire.empty());
+
+	string xml = tool.createBatchXML(batch);
+	DOMParser parser;
+	AutoPtr<Document> doc = parser.parseString(xml);
+	Element *root = doc->documentElement();
+
+	CHECK(root != NULL && root->nodeName() == "adapter_server");
+	if (root == NULL)
+		return;
+	CHECK(root->getAttribute("count") == "3");
+	CHECK(root->getAttribute("state") == "data");
+
+	AutoPtr<NodeList> devices = root->getElementsByTagName("device");
+	CHECK(devices->length() == 3);
+	for (unsigned long i = 0; i < devices->length() && i < batch.size(); i++) {
+		Element *device = static_cast<Element *>(devices->item(i));
+
+		CHECK(device->getAttribute("index") == to_string(i));
+		CHECK(device->getAttribute("time") == to_string(batch[i].time));
+		CHECK(device->hasAttribute("seq") == (batch[i].seq != 0));
+		CHECK(batch[i].seq == 0 || device->getAttribute("seq") == to_string(batch[i].seq));
+		CHECK(device->getAttribute("euid") == toStringFromLongHex(batch[i].device.euid));
+
+		AutoPtr<NodeList> values = device->getElementsByTagName("value");
+		CHECK(values->length() == batch[i].device.values.size());
+	}
+}
+
+int main() {
+	testParseAcks();
+	testParseWithoutAcks();
+	testBatch();
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -376,6 +376,8 @@ struct IOTMessage {
 	bool valid;             // Flag to mark non valid time in the message
 	long long int tt_version;// Version of table types, used in registration messages
 	CmdParam params;		// Struct with parameters
+	uint64_t seq;           // Sequence number of data message acknowledged by the server (0 = none)
+	std::string wire;       // Serialized <device> element without its leading tag name and time (see XMLTool::createDeviceWire)
 
 	IOTMessage() :
 		protocol_version(PROTOCOL_VERSION),
@@ -388,7 +390,8 @@ struct IOTMessage {
 		priority(MSG_PRIO_SENSOR),
 		offset(0),
 		valid(false),
-		tt_version(0)
+		tt_version(0),
+		seq(0)
 	{ }
 
 	void print() {
@@ -428,13 +431,19 @@ struct Command {
 	long long int time;             // when should the sensor wake up
 	std::vector<std::pair<int, float> > values;
 	CmdParam params;
+	std::vector<int> acks;          // indexes of devices from a batch processed by the server
+	std::vector<uint64_t> acked_seqs;   // sequence numbers of messages processed by the server
+	int drain_rate;                 // cached messages per second requested by the server (-1 = not requested)
+	int drain_burst;                // burst of cached messages allowed by the server (-1 = not requested)
 
 	Command() :
 		protocol_version(FW_VERSION),
 		state("data"),
 		euid(0),
 		device_id(0),
-		time(0)
+		time(0),
+		drain_rate(-1),
+		drain_burst(-1)
 	{	}
 
 	void print() {